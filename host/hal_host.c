@@ -0,0 +1,660 @@
+/**
+ * @file hal_host.c
+ * @brief Host (Linux) backend of the HAL
+ *
+ * Builds the firmware into a native executable ('make host'). The 1ms
+ * Timer 0 tick is a SIGALRM from setitimer(); the signal mask plays the
+ * role of the I flag, so hal_irq_disable() really keeps the "ISRs" out.
+ * Every tick the simulation:
+ *	- runs TIMER0_COMPA/COMPB_vect and decodes the tube/cathode port bits
+ *	- advances Timer 1 and a DS1307 model, which drives SQW/OUT (INT0)
+ *	- runs TWI_vect until the TWI model has no interrupt pending
+ *	- runs ADC_vect ADC_SAMPLES times when the ADC free runs with ADIE set
+ *	- runs EE_READY_vect once when enabled; EEPROM writes complete at once
+ *	  and go to the file named by $HOST_EEPROM, if set, to survive restarts
+ *	- runs USART_UDRE_vect and USART_RX_vect up to UART_BYTES_MS times
+ *	  each while enabled. $HOST_UART names a file that gets the bytes sent,
+ *	  or is "pty": a pseudo terminal, its name printed on stderr, carries
+ *	  both directions (e.g. 'screen /dev/pts/N')
+ *	- reads key presses from stdin: "1".."4" short press, "1h".."4h" hold,
+ *	  "q" quits
+ * The display is printed to stdout whenever it changes.
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#define _GNU_SOURCE		// posix_openpt()
+
+#include "hal.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define TICK_US			1000	// Timer 0 period
+#define T1_COUNTS_MS	15625	// Timer 1 counts per 1000 ms at 16MHz/1024
+#define TWI_MAX_STEPS	64		// TWI_vect runs per tick, runaway guard
+#define ADC_SAMPLES		9		// conversions per ms at 16MHz/128/13
+#define EEPROM_SIZE		1024
+#define UART_BYTES_MS	11		// 115200 baud, 10 bits per byte
+
+#define DS1307_ADDR		0xD0
+#define DS1307_CH		0x80	// seconds register: clock halt
+#define DS1307_SQWE		0x10	// control register: square wave enable
+
+// ADC readings of the push button ladder
+#define ADC_NO_KEY		0x3FF
+static const uint16_t adc_keys[5] = { ADC_NO_KEY, 0x040, 0x100, 0x250, 0x350 };
+
+#define KEY_SHORT_MS	100
+#define KEY_HOLD_MS		1500
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+// Passive registers
+volatile uint8_t PORTB, DDRB, PINB;
+volatile uint8_t PORTC, DDRC, PINC;
+volatile uint8_t PORTD, DDRD, PIND;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t EICRA, EIMSK, EIFR;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB;
+
+// Interrupt vectors, only those the firmware defines are linked in
+extern void TIMER0_COMPA_vect(void) __attribute__((weak));
+extern void TIMER0_COMPB_vect(void) __attribute__((weak));
+extern void TIMER1_COMPA_vect(void) __attribute__((weak));
+extern void INT0_vect(void) __attribute__((weak));
+extern void TWI_vect(void) __attribute__((weak));
+extern void ADC_vect(void) __attribute__((weak));
+extern void EE_READY_vect(void) __attribute__((weak));
+extern void USART_UDRE_vect(void) __attribute__((weak));
+extern void USART_RX_vect(void) __attribute__((weak));
+
+static volatile uint8_t irq_on = 0;
+
+// EEPROM, erased, optionally backed by a file
+static uint8_t eeprom[EEPROM_SIZE];
+static uint8_t ee_irq = 0;
+static int ee_fd = -1;
+
+// UART: output file, or pty master for both directions
+static uint8_t uart_udrie = 0;
+static uint8_t uart_rxcie = 0;
+static uint8_t uart_udr = 0;		// received byte
+static int uart_fd = -1;
+static int uart_pts = -1;			// slave end kept open: no EIO without a client
+static sigset_t tick_set;
+
+// Timer 1 fractional counts
+static uint32_t t1_frac = 0;
+
+// TWI master and DS1307 model
+static struct {
+	uint8_t twcr;
+	uint8_t twint;
+	uint8_t status;
+	uint8_t twdr;
+	uint8_t bus;			// bus owned (start sent, no stop yet)
+	uint8_t expect_addr;
+	uint8_t selected;
+	uint8_t reading;
+} twi;
+
+static struct {
+	uint8_t reg[64];
+	uint8_t ptr;
+	uint8_t ptr_set;
+	uint16_t ms;
+} rtc;
+
+// Push buttons
+static uint8_t key = 0;
+static uint16_t key_ms = 0;
+
+// Display
+static uint8_t tube_digit[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+static uint8_t shown[4] = { 0, 0, 0, 0 };
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void uart_pty_open(void);
+
+/*===========================================================================*/
+void hal_host_irq_set(uint8_t on)
+{
+	if (on) {
+		irq_on = 1;
+		sigprocmask(SIG_UNBLOCK, &tick_set, NULL);
+	} else {
+		sigprocmask(SIG_BLOCK, &tick_set, NULL);
+		irq_on = 0;
+	}
+}
+
+/*===========================================================================*/
+uint8_t hal_host_irq_get(void)
+{
+	return irq_on;
+}
+
+/*===========================================================================*/
+uint8_t hal_host_irq_save(void)
+{
+	uint8_t state = irq_on;
+
+	hal_host_irq_set(0);
+	return state;
+}
+
+/*===========================================================================*/
+void hal_host_irq_restore(uint8_t state, uint8_t type)
+{
+	if (state || (type == ATOMIC_FORCEON))
+		hal_host_irq_set(1);
+}
+
+/* Sleep --------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Waits for the next tick with SIGALRM unblocked, like SEI + SLEEP. Returns
+* with it blocked again.
+*/
+void hal_sleep_idle(void)
+{
+	sigset_t none;
+
+	sigemptyset(&none);
+	irq_on = 1;
+	sigsuspend(&none);
+	irq_on = 0;
+}
+
+/* TWI ----------------------------------------------------------------------*/
+
+/*===========================================================================*/
+void hal_twi_init(uint8_t bitrate)
+{
+	(void)bitrate;
+	memset(&twi, 0, sizeof(twi));
+}
+
+/*===========================================================================*/
+/*
+* Performs the bus action requested by a TWCR write at once and sets TWINT
+* with the resulting status, as the hardware would ~100us later.
+*/
+void hal_twi_control(uint8_t twcr)
+{
+	twi.twcr = twcr;
+
+	if (!(twcr & _BV(TWEN))) {		// TWI off, bus released
+		twi.twint = 0;
+		twi.bus = 0;
+		twi.selected = 0;
+		return;
+	}
+	if (!(twcr & _BV(TWINT)))
+		return;
+	twi.twint = 0;
+
+	if (twcr & _BV(TWSTO)) {
+		twi.bus = 0;
+		twi.selected = 0;
+		if (!(twcr & _BV(TWSTA)))
+			return;
+	}
+
+	if (twcr & _BV(TWSTA)) {
+		twi.status = twi.bus ? 0x10 : 0x08;
+		twi.bus = 1;
+		twi.expect_addr = 1;
+		twi.selected = 0;
+	} else if (twi.expect_addr) {
+		twi.expect_addr = 0;
+		twi.reading = twi.twdr & 0x01;
+		twi.selected = ((twi.twdr & 0xFE) == DS1307_ADDR);
+		if (twi.selected && !twi.reading)
+			rtc.ptr_set = 0;
+		if (twi.reading) twi.status = twi.selected ? 0x40 : 0x48;
+		else twi.status = twi.selected ? 0x18 : 0x20;
+	} else if (twi.selected && !twi.reading) {
+		if (!rtc.ptr_set) {
+			rtc.ptr = twi.twdr & 0x3F;
+			rtc.ptr_set = 1;
+		} else {
+			rtc.reg[rtc.ptr] = twi.twdr;
+			if (rtc.ptr == 0)
+				rtc.ms = 0;		// seconds write restarts the countdown chain
+			rtc.ptr = (rtc.ptr + 1) & 0x3F;
+		}
+		twi.status = 0x28;
+	} else if (twi.selected && twi.reading) {
+		twi.twdr = rtc.reg[rtc.ptr];
+		rtc.ptr = (rtc.ptr + 1) & 0x3F;
+		twi.status = (twcr & _BV(TWEA)) ? 0x50 : 0x58;
+	} else {
+		twi.status = 0x00;		// bus error
+	}
+	twi.twint = 1;
+}
+
+/*===========================================================================*/
+uint8_t hal_twi_ready(void)
+{
+	return twi.twint ? _BV(TWINT) : 0;
+}
+
+/*===========================================================================*/
+uint8_t hal_twi_stopping(void)
+{
+	return 0;
+}
+
+/*===========================================================================*/
+uint8_t hal_twi_status(void)
+{
+	return twi.status;
+}
+
+/*===========================================================================*/
+void hal_twi_write(uint8_t data)
+{
+	twi.twdr = data;
+}
+
+/*===========================================================================*/
+uint8_t hal_twi_read(void)
+{
+	return twi.twdr;
+}
+
+/*===========================================================================*/
+/*
+* Bus recovery pins: the simulated DS1307 never holds SDA, so the lines
+* just follow DDRC and read back released.
+*/
+void hal_twi_pins_release(void)
+{
+	PORTC &= ~(_BV(PORTC4) | _BV(PORTC5));
+	DDRC &= ~(_BV(DDC4) | _BV(DDC5));
+}
+
+/*===========================================================================*/
+void hal_twi_scl(uint8_t high)
+{
+	if (high) DDRC &= ~_BV(DDC5);
+	else DDRC |= _BV(DDC5);
+}
+
+/*===========================================================================*/
+void hal_twi_sda(uint8_t high)
+{
+	if (high) DDRC &= ~_BV(DDC4);
+	else DDRC |= _BV(DDC4);
+}
+
+/*===========================================================================*/
+uint8_t hal_twi_sda_read(void)
+{
+	return PINC & _BV(PINC4);
+}
+
+/* ADC ----------------------------------------------------------------------*/
+
+/*===========================================================================*/
+uint16_t hal_adc_read(void)
+{
+	// only channel 1 has the buttons; anything else is a floating input
+	if ((ADMUX & 0x0F) != 1)
+		return rand() & 0x3FF;
+	return adc_keys[key];
+}
+
+/*===========================================================================*/
+uint8_t hal_adc_busy(void)
+{
+	return 0;
+}
+
+/*===========================================================================*/
+uint8_t hal_adc_read8(void)
+{
+	return hal_adc_read() >> 2;
+}
+
+/*===========================================================================*/
+uint8_t hal_adc_done(void)
+{
+	return 1;
+}
+
+/* EEPROM -------------------------------------------------------------------*/
+
+/*===========================================================================*/
+uint8_t hal_eeprom_read(uint16_t addr)
+{
+	return eeprom[addr % EEPROM_SIZE];
+}
+
+/*===========================================================================*/
+void hal_eeprom_write(uint16_t addr, uint8_t data)
+{
+	addr %= EEPROM_SIZE;
+	eeprom[addr] = data;
+	if (ee_fd >= 0)
+		(void)!pwrite(ee_fd, &data, 1, addr);
+}
+
+/*===========================================================================*/
+void hal_eeprom_irq(uint8_t on)
+{
+	ee_irq = on;
+}
+
+/* UART ---------------------------------------------------------------------*/
+
+/*===========================================================================*/
+void hal_uart_init(uint16_t ubrr)
+{
+	const char *name = getenv("HOST_UART");
+
+	(void)ubrr;
+	if ((uart_fd >= 0) || (name == NULL))
+		return;
+	if (strcmp(name, "pty") == 0)
+		uart_pty_open();
+	else
+		uart_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+/*===========================================================================*/
+void hal_uart_write(uint8_t data)
+{
+	if (uart_fd >= 0)
+		(void)!write(uart_fd, &data, 1);
+}
+
+/*===========================================================================*/
+uint8_t hal_uart_read(void)
+{
+	return uart_udr;
+}
+
+/*===========================================================================*/
+void hal_uart_tx_irq(uint8_t on)
+{
+	uart_udrie = on;
+}
+
+/*===========================================================================*/
+void hal_uart_rx_irq(uint8_t on)
+{
+	uart_rxcie = on;
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+static uint8_t bcd_inc(uint8_t v, uint8_t top, uint8_t first, uint8_t *carry)
+{
+	v = ((v & 0x0F) == 9) ? (v & 0xF0) + 0x10 : v + 1;
+	*carry = (v > top);
+	return *carry ? first : v;
+}
+
+/*===========================================================================*/
+static uint8_t to_bcd(int v)
+{
+	return ((v / 10) << 4) | (v % 10);
+}
+
+/*===========================================================================*/
+/*
+* DS1307 seconds count; SQW/OUT falls at the same time.
+*/
+static void rtc_second(void)
+{
+	uint8_t carry;
+	uint8_t h, v;
+
+	if (!(rtc.reg[0] & DS1307_CH)) {
+		rtc.reg[0] = bcd_inc(rtc.reg[0], 0x59, 0x00, &carry);
+		if (carry) rtc.reg[1] = bcd_inc(rtc.reg[1], 0x59, 0x00, &carry);
+		if (carry) {
+			h = rtc.reg[2];
+			if (h & 0x40) {		// 12h mode
+				v = bcd_inc(h & 0x1F, 0x12, 0x01, &carry);
+				if (v == 0x12) h ^= 0x20;
+				rtc.reg[2] = (h & 0x60) | v;
+			} else {
+				rtc.reg[2] = bcd_inc(h & 0x3F, 0x23, 0x00, &carry);
+			}
+		}
+	}
+
+	if ((rtc.reg[7] & DS1307_SQWE) && (EIMSK & _BV(INT0)) && INT0_vect)
+		INT0_vect();
+}
+
+/*===========================================================================*/
+/*
+* Decodes the tube being multiplexed from the anode (active low) and
+* cathode driver bits.
+*/
+static void display_sample(void)
+{
+	uint8_t code;
+	int t;
+
+	if (!(PORTB & _BV(PORTB1))) t = 0;
+	else if (!(PORTB & _BV(PORTB2))) t = 1;
+	else if (!(PORTB & _BV(PORTB3))) t = 2;
+	else if (!(PORTD & _BV(PORTD3))) t = 3;
+	else return;
+
+	code = ((PORTD >> PORTD5) & 0x07) | ((PORTB & _BV(PORTB0)) << 3);
+	if (code > 9) tube_digit[t] = 0xFF;
+	else tube_digit[t] = code ? (10 - code) : 0;
+}
+
+/*===========================================================================*/
+/*
+* Tube D is the leftmost one.
+*/
+static void display_print(void)
+{
+	char line[16];
+	int n = 0;
+
+	if (memcmp(shown, tube_digit, sizeof(shown)) == 0)
+		return;
+	memcpy(shown, tube_digit, sizeof(shown));
+
+	line[n++] = '\r';
+	for (int t = 3; t >= 0; t--) {
+		line[n++] = (shown[t] > 9) ? ' ' : '0' + shown[t];
+		if (t == 2) line[n++] = ':';
+	}
+	line[n++] = ' ';
+	(void)!write(STDOUT_FILENO, line, n);
+}
+
+/*===========================================================================*/
+/*
+* Raw, non-blocking pseudo terminal for the UART; a full output buffer (no
+* client reading) drops bytes instead of stalling the tick.
+*/
+static void uart_pty_open(void)
+{
+	struct termios t;
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if ((fd < 0) || grantpt(fd) || unlockpt(fd)) {
+		perror("HOST_UART pty");
+		return;
+	}
+	uart_pts = open(ptsname(fd), O_RDWR | O_NOCTTY);
+	if ((uart_pts >= 0) && (tcgetattr(uart_pts, &t) == 0)) {
+		cfmakeraw(&t);
+		tcsetattr(uart_pts, TCSANOW, &t);
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fprintf(stderr, "UART on %s\n", ptsname(fd));
+	uart_fd = fd;
+}
+
+/*===========================================================================*/
+static void keys_poll(void)
+{
+	char buf[16];
+	ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+
+	for (ssize_t i = 0; i < n; i++) {
+		if ((buf[i] >= '1') && (buf[i] <= '4')) {
+			key = buf[i] - '0';
+			key_ms = KEY_SHORT_MS;
+		} else if ((buf[i] == 'h') && key) {
+			key_ms = KEY_HOLD_MS;
+		} else if (buf[i] == 'q') {
+			(void)!write(STDOUT_FILENO, "\n", 1);
+			_exit(0);
+		}
+	}
+
+	if (key_ms && (--key_ms == 0))
+		key = 0;
+}
+
+/*===========================================================================*/
+/*
+* 1ms tick. Runs with SIGALRM blocked, like an ISR with the I flag clear.
+*/
+static void tick(int sig)
+{
+	int steps = 0;
+
+	(void)sig;
+	irq_on = 0;
+
+	// Timer 0, CTC on OCR0A; compare B within the same period
+	if ((TCCR0B & 0x07) && (TIMSK0 & _BV(OCIE0A)) && TIMER0_COMPA_vect) {
+		TIMER0_COMPA_vect();
+		if ((TIMSK0 & _BV(OCIE0B)) && (OCR0B <= OCR0A) && TIMER0_COMPB_vect)
+			TIMER0_COMPB_vect();
+		display_sample();
+	}
+
+	// Timer 1, CTC on OCR1A
+	if (TCCR1B & 0x07) {
+		t1_frac += T1_COUNTS_MS;
+		TCNT1 += t1_frac / 1000;
+		t1_frac %= 1000;
+		if (TCNT1 > OCR1A) {
+			TCNT1 -= OCR1A + 1;
+			if ((TIMSK1 & _BV(OCIE1A)) && TIMER1_COMPA_vect)
+				TIMER1_COMPA_vect();
+		}
+	}
+
+	// DS1307
+	if (++rtc.ms == 1000) {
+		rtc.ms = 0;
+		rtc_second();
+	}
+
+	// TWI
+	while (twi.twint && (twi.twcr & _BV(TWIE)) && TWI_vect && (steps++ < TWI_MAX_STEPS))
+		TWI_vect();
+
+	// ADC, free running
+	if ((ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADATE)) && (ADCSRA & _BV(ADIE)) && ADC_vect)
+		for (int i = 0; i < ADC_SAMPLES; i++)
+			ADC_vect();
+
+	// EEPROM ready, one byte per tick
+	if (ee_irq && EE_READY_vect)
+		EE_READY_vect();
+
+	// UART data register empty / receive complete, at the line rate
+	for (int i = 0; uart_udrie && USART_UDRE_vect && (i < UART_BYTES_MS); i++)
+		USART_UDRE_vect();
+	for (int i = 0; uart_rxcie && USART_RX_vect && (uart_pts >= 0) && (i < UART_BYTES_MS); i++) {
+		if (read(uart_fd, &uart_udr, 1) != 1)
+			break;
+		USART_RX_vect();
+	}
+
+	keys_poll();
+	if (rtc.ms % 50 == 0)
+		display_print();
+
+	irq_on = 1;
+}
+
+/*===========================================================================*/
+/*
+* Runs before the firmware's main(): the MCU comes out of reset with
+* interrupts disabled and the RTC holding the host's local time.
+*/
+__attribute__((constructor))
+static void hal_host_init(void)
+{
+	struct sigaction sa;
+	struct itimerval it;
+	time_t now = time(NULL);
+	struct tm *lt = localtime(&now);
+
+	rtc.reg[0] = to_bcd(lt->tm_sec);
+	rtc.reg[1] = to_bcd(lt->tm_min);
+	rtc.reg[2] = to_bcd(lt->tm_hour);
+	rtc.reg[3] = lt->tm_wday + 1;
+	rtc.reg[4] = to_bcd(lt->tm_mday);
+	rtc.reg[5] = to_bcd(lt->tm_mon + 1);
+	rtc.reg[6] = to_bcd(lt->tm_year % 100);
+	rtc.reg[7] = DS1307_SQWE;
+	PINC = _BV(PINC4) | _BV(PINC5);	// SDA, SCL pulled up
+	srand((unsigned)now ^ (unsigned)getpid());
+
+	memset(eeprom, 0xFF, sizeof(eeprom));
+	if (getenv("HOST_EEPROM")) {
+		ee_fd = open(getenv("HOST_EEPROM"), O_RDWR | O_CREAT, 0644);
+		if ((ee_fd >= 0) && (read(ee_fd, eeprom, sizeof(eeprom)) < (ssize_t)sizeof(eeprom)))
+			(void)!pwrite(ee_fd, eeprom, sizeof(eeprom), 0);	// new file: erased
+	}
+
+	fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+	sigemptyset(&tick_set);
+	sigaddset(&tick_set, SIGALRM);
+	hal_host_irq_set(0);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = tick;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGALRM, &sa, NULL);
+
+	it.it_interval.tv_sec = 0;
+	it.it_interval.tv_usec = TICK_US;
+	it.it_value = it.it_interval;
+	setitimer(ITIMER_REAL, &it, NULL);
+}
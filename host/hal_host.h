@@ -0,0 +1,187 @@
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+#include <stddef.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* Host backend of the HAL (see src/hal.h). Passive registers (ports, timer
+* and ADC configuration) are plain variables that the simulation in
+* hal_host.c samples; everything with side effects goes through hal_*().
+*/
+
+#define _BV(bit)				(1 << (bit))
+
+// Interrupts: vectors are plain functions called by the simulated timer
+#define HAL_ISR(vector)			void vector(void)
+#define hal_irq_enable()		hal_host_irq_set(1)
+#define hal_irq_disable()		hal_host_irq_set(0)
+#define hal_irq_enabled()		hal_host_irq_get()
+
+// <util/atomic.h>
+#define ATOMIC_RESTORESTATE		0
+#define ATOMIC_FORCEON			1
+#define ATOMIC_BLOCK(type)		for (uint8_t _irq = hal_host_irq_save(), _once = 1; \
+									_once; hal_host_irq_restore(_irq, (type)), _once = 0)
+
+// <avr/pgmspace.h>
+#define PROGMEM
+#define PSTR(s)					(s)
+#define pgm_read_byte(addr)		(*(const uint8_t *)(addr))
+#define pgm_read_word(addr)		(*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr)		(*(void * const *)(addr))
+
+/* Register bits used by the firmware --------------------------------------*/
+
+// PORTB / DDRB
+#define PORTB0	0
+#define PORTB1	1
+#define PORTB2	2
+#define PORTB3	3
+#define PORTB4	4
+#define PORTB5	5
+#define DDB0	0
+#define DDB1	1
+#define DDB2	2
+#define DDB3	3
+#define DDB4	4
+#define DDB5	5
+// PORTC / DDRC
+#define PORTC0	0
+#define PORTC1	1
+#define PORTC2	2
+#define PORTC3	3
+#define PORTC4	4
+#define PORTC5	5
+#define DDC0	0
+#define DDC1	1
+#define DDC2	2
+#define DDC3	3
+#define DDC4	4
+#define DDC5	5
+#define PINC4	4
+#define PINC5	5
+// PORTD / DDRD
+#define PORTD0	0
+#define PORTD1	1
+#define PORTD2	2
+#define PORTD3	3
+#define PORTD4	4
+#define PORTD5	5
+#define PORTD6	6
+#define PORTD7	7
+#define DDD0	0
+#define DDD1	1
+#define DDD2	2
+#define DDD3	3
+#define DDD4	4
+#define DDD5	5
+#define DDD6	6
+#define DDD7	7
+// Timer 0
+#define WGM00	0
+#define WGM01	1
+#define CS00	0
+#define CS01	1
+#define CS02	2
+#define OCIE0A	1
+#define OCIE0B	2
+#define OCF0A	1
+#define OCF0B	2
+// Timer 1
+#define WGM12	3
+#define CS10	0
+#define CS11	1
+#define CS12	2
+#define OCIE1A	1
+#define OCF1A	1
+// External interrupts
+#define ISC00	0
+#define ISC01	1
+#define INT0	0
+#define INTF0	0
+// ADC
+#define MUX0	0
+#define MUX1	1
+#define MUX2	2
+#define MUX3	3
+#define ADLAR	5
+#define REFS0	6
+#define REFS1	7
+#define ADPS0	0
+#define ADPS1	1
+#define ADPS2	2
+#define ADIE	3
+#define ADIF	4
+#define ADATE	5
+#define ADSC	6
+#define ADEN	7
+// TWI
+#define TWIE	0
+#define TWEN	2
+#define TWWC	3
+#define TWSTO	4
+#define TWSTA	5
+#define TWEA	6
+#define TWINT	7
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+extern volatile uint8_t PORTB, DDRB, PINB;
+extern volatile uint8_t PORTC, DDRC, PINC;
+extern volatile uint8_t PORTD, DDRD, PIND;
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A;
+extern volatile uint8_t EICRA, EIMSK, EIFR;
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB;
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void hal_host_irq_set(uint8_t on);
+uint8_t hal_host_irq_get(void);
+uint8_t hal_host_irq_save(void);
+void hal_host_irq_restore(uint8_t state, uint8_t type);
+
+void hal_sleep_idle(void);
+
+void hal_twi_init(uint8_t bitrate);
+void hal_twi_control(uint8_t twcr);
+uint8_t hal_twi_ready(void);
+uint8_t hal_twi_stopping(void);
+uint8_t hal_twi_status(void);
+void hal_twi_write(uint8_t data);
+uint8_t hal_twi_read(void);
+void hal_twi_pins_release(void);
+void hal_twi_scl(uint8_t high);
+void hal_twi_sda(uint8_t high);
+uint8_t hal_twi_sda_read(void);
+
+uint16_t hal_adc_read(void);
+uint8_t hal_adc_busy(void);
+uint8_t hal_adc_read8(void);
+uint8_t hal_adc_done(void);
+
+uint8_t hal_eeprom_read(uint16_t addr);
+void hal_eeprom_write(uint16_t addr, uint8_t data);
+void hal_eeprom_irq(uint8_t on);
+
+void hal_uart_init(uint16_t ubrr);
+void hal_uart_write(uint8_t data);
+uint8_t hal_uart_read(void);
+void hal_uart_tx_irq(uint8_t on);
+void hal_uart_rx_irq(uint8_t on);
+
+#endif	/* HAL_HOST_H */
@@ -7,13 +7,17 @@
 #include "config.h"
 #include "util.h"
 
-#include <avr/io.h>
+#include "hal.h"
 
 /******************************************************************************
 *************** G L O B A L   V A R S   D E F I N I T I O N S *****************
 ******************************************************************************/
 
-volatile btn_s 		btn1, btn2, btn3, btn4;
+static uint16_t		noise;		// random seed gathered at startup
+
+// Button ladder samples, one per adc_key_press() call
+static uint8_t			ring[ADC_RING_LEN];
+static uint8_t			ring_head;
 
 /******************************************************************************
 ******************* C O N S T A N T   D E F I N I T I O N S *******************
@@ -22,13 +26,15 @@ volatile btn_s 		btn1, btn2, btn3, btn4;
 #define ADC_PRESCALER_DIV128 	((1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0))
 #define ADC_MUX_MASK			((1<< MUX3) | (1<<MUX2) | (1<<MUX1) | (1<<MUX0))
 
-#define ADC_READ_N 		3
+#define ADC_NOISE_N		32		// conversions mixed into the random seed
 
 /******************************************************************************
 ******************* F U N C T I O N   D E F I N I T I O N S *******************
 ******************************************************************************/
 
-static uint16_t adc_read(uint8_t run);
+static uint8_t adc_median(void);
+static void adc_store(void);
+static uint16_t adc_noise(void);
 
 /*===========================================================================*/
 void adc_init(uint8_t run)
@@ -36,71 +42,46 @@ void adc_init(uint8_t run)
 	ADMUX &= ~(ADC_MUX_MASK);			/* Clear ADC mux selection */
 	ADCSRA |= ADC_PRESCALER_DIV128;		/* Set prescaler */
 	ADMUX |= (1<<REFS0);                // Voltage reference from Avcc (5v)
-	ADMUX |= (1<<MUX0);  				// Sectlect channel 1 as ADC input
 	ADCSRA |= (1<<ADEN);				/* Enable ADC conversions */
 
-	if (run) // Free running conversion
+	noise = adc_noise();				// floating ADC0, before channel 1 is set
+
+	ADMUX |= (1<<MUX0);  				// Sectlect channel 1 as ADC input
+
+	if (run) { // Free running conversion
+		ADMUX |= (1<<ADLAR);	// 8 bit results, read from ADCH
 		ADCSRA |= (1<<ADATE);	// Autotrigger enable
+	}
 	
 	ADCSRA |= (1<<ADSC);     	//Do an initial conversion because this one is the slowest and to ensure that everything is up and running
 
-	// Button handlers init
-	btn1.n = 1;
-	btn1.query = FALSE;
-	btn1.action = FALSE;
-	btn1.lock = FALSE;
-	btn1.state = BTN_IDLE;
-	btn1.count = 0;
-	btn1.delay1 = FALSE;
-	btn1.delay2 = FALSE;
-	btn1.delay3 = FALSE;
-
-	btn2.n = 2;
-	btn2.query = FALSE;
-	btn2.action = FALSE;
-	btn2.lock = FALSE;
-	btn2.state = BTN_IDLE;
-	btn2.count = 0;
-	btn2.delay1 = FALSE;
-	btn2.delay2 = FALSE;
-	btn2.delay3 = FALSE;
-
-	btn3.n = 3;
-	btn3.query = FALSE;
-	btn3.action = FALSE;
-	btn3.lock = FALSE;
-	btn3.state = BTN_IDLE;
-	btn3.count = 0;
-	btn3.delay1 = FALSE;
-	btn3.delay2 = FALSE;
-	btn3.delay3 = FALSE;
-
-	btn4.n = 4;
-	btn4.query = FALSE;
-	btn4.action = FALSE;
-	btn4.lock = FALSE;
-	btn4.state = BTN_IDLE;
-	btn4.count = 0;
-	btn4.delay1 = FALSE;
-	btn4.delay2 = FALSE;
-	btn4.delay3 = FALSE;
+	// Fill the sample ring before the first key read
+	if (run)
+		for (uint8_t i = 0; i < ADC_RING_LEN; i++) {
+			while (!hal_adc_done());
+			adc_store();
+		}
 }
 
 /*===========================================================================*/
 uint8_t adc_key_press(void)
 {
-	uint16_t data = adc_read(TRUE);
-	int key = 5; 
+	uint8_t data;
+	uint8_t key = 5; 
+
+	if (hal_adc_done())			// a conversion finished since the last call
+		adc_store();
+	data = adc_median();
 	
-	if (data < 0x3C1) 			//(data < 0x384) V<4.7V
+	if (data < 0xF0) 			// V<4.7V
 	{
-		if(data > 0x2F5)		//(data > 0x2b7) V>3.7              
+		if(data > 0xBD)			// V>3.7V
 			key = 4;
-		else if(data > 0x199)	//(data > 0x199) V>2V          
+		else if(data > 0x66)	// V>2V
 			key = 3;
-		else if(data > 0x08f)	//(data > 0x08f) V>0.7       
+		else if(data > 0x23)	// V>0.7V
 			key = 2;
-		else if(data < 0x08f)	//(data < 0x08f) V<0.7       
+		else					// V<0.7V
 			key = 1;
 	}
 	
@@ -108,13 +89,12 @@ uint8_t adc_key_press(void)
 }
 
 /*===========================================================================*/
-volatile btn_s * adc_get_button_handler(uint8_t btn)
+/*
+* Seed for the random number generator, taken from ADC noise at startup.
+*/
+uint16_t adc_get_noise(void)
 {
-	if (btn == 1) return &btn1;
-	else if (btn == 2) return &btn2;
-	else if (btn == 3) return &btn3;
-	else if (btn == 4) return &btn4;
-	else return NULL;
+	return noise;
 }
 
 /*-----------------------------------------------------------------------------
@@ -122,21 +102,47 @@ volatile btn_s * adc_get_button_handler(uint8_t btn)
 -----------------------------------------------------------------------------*/
 
 /*===========================================================================*/
-static uint16_t adc_read(uint8_t run)
-{	
-	uint16_t avg = 0;
-	
-	if (run) {
-		avg = ADC;
-	} else {
-		ADCSRA |= (1<<ADSC);			/* This starts the conversion. */
-		// perform n reads
-		for (uint8_t i = 0; i < ADC_READ_N; i++){
-			while ((ADCSRA & (1<<ADSC)));	/* Wait 'til conversion completed */
-			avg += ADC;
-		}
-		avg = avg / ((uint16_t)ADC_READ_N);	// average value	
+/*
+* Median of the sample ring (insertion sort).
+*/
+static uint8_t adc_median(void)
+{
+	uint8_t s[ADC_RING_LEN];
+	uint8_t v, j;
+
+	for (uint8_t i = 0; i < ADC_RING_LEN; i++) {
+		v = ring[i];
+		for (j = i; (j > 0) && (s[j - 1] > v); j--)
+			s[j] = s[j - 1];
+		s[j] = v;
 	}
-	
-	return avg;
-}
\ No newline at end of file
+
+	return s[ADC_RING_LEN / 2];
+}
+
+/*===========================================================================*/
+static void adc_store(void)
+{
+	ring[ring_head] = hal_adc_read8();
+	ring_head = (ring_head + 1) & (ADC_RING_LEN - 1);
+}
+
+/*===========================================================================*/
+/*
+* Mixes the LSBs of a burst of single conversions on the unconnected ADC0
+* input (PC0). Each one is rotated into the result, so even one noisy bit
+* per sample fills the 16 bits.
+*/
+static uint16_t adc_noise(void)
+{
+	uint16_t mix = 0;
+
+	for (uint8_t i = 0; i < ADC_NOISE_N; i++) {
+		ADCSRA |= (1<<ADSC);
+		while (hal_adc_busy());
+		mix = (mix << 3) | (mix >> 13);
+		mix ^= hal_adc_read();
+	}
+
+	return mix;
+}
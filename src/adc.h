@@ -8,26 +8,19 @@
 
 #include <stdint.h>
 
-/******************************************************************************
-***************** S T R U C T U R E   D E C L A R A T I O N S *****************
-******************************************************************************/
-
-typedef struct {
-	uint8_t n;
-	uint8_t query;	// flag; query button state
-	uint8_t action;			// flag; button action activated
-	uint8_t lock;			// flag; button locked
-	uint8_t state;			// button state: IDLE, PUSHED, RELEASED
-	uint16_t count;			// time counter
-	uint8_t delay1;			// flag; delay 1 elapsed
-	uint8_t delay2;			// flag; delay 2 elapsed
-	uint8_t delay3;			// flag; delay 3 elapsed
-} btn_s;
-
 /******************************************************************************
 ******************* C O N S T A N T   D E F I N I T I O N S *******************
 ******************************************************************************/
 
+/*
+* Button sampling: the ADC free runs on channel 1 with its interrupt off,
+* so it never wakes the CPU. Each adc_key_press() call (the 1ms button
+* task) keeps the latest 8 bit result in a ring of ADC_RING_LEN and
+* classifies their median, about 8ms of samples, so a single glitch can't
+* turn into a wrong key.
+*/
+#define ADC_RING_LEN	8		// power of 2
+
 /******************************************************************************
 ******************** F U N C T I O N   P R O T O T Y P E S ********************
 ******************************************************************************/
@@ -35,6 +28,6 @@ typedef struct {
 void adc_init(uint8_t run);
 
 uint8_t adc_key_press(void);
-volatile btn_s * adc_get_button_handler(uint8_t btn);
+uint16_t adc_get_noise(void);
 
 #endif 	/* ADC_H */
\ No newline at end of file
@@ -0,0 +1,138 @@
+/**
+ * @file anim.c
+ * @brief Display animations
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "anim.h"
+#include "config.h"
+#include "rtc.h"
+#include "settings.h"
+#include "timers.h"
+#include "util.h"
+
+#include "hal.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* Cathode exercise (anti cathode poisoning): every tube is cycled through
+* all ten cathodes, ANIM_PASSES times, each digit lit for ANIM_DIGIT_MS.
+* It runs at minute 0 of the SET_CATHODE_HOUR setting (0-23), or of every
+* hour when that is ANIM_EVERY_HOUR.
+*/
+#define ANIM_PASSES			4		// 4 x 10 x 80ms = 3.2s
+
+/******************************************************************************
+******************* P R O G R A M   M E M O R Y   T A B L E S *****************
+******************************************************************************/
+
+// Steps coprime with 10: adding any of them mod 10 visits all ten digits
+static const uint8_t anim_strides[4] PROGMEM = { 1, 3, 7, 9 };
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static uint8_t running;			// flag; cathode exercise in progress
+static uint8_t pass;			// passes done
+static uint8_t idx;				// digits shown in the current pass
+static uint8_t digit[4];		// digit on each tube
+static uint8_t stride[4];		// digit step of each tube, this pass
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void anim_shuffle(void);
+
+/*===========================================================================*/
+/*
+* TRUE when the cathode exercise should start. To be called when the minutes
+* change, after the clock has been ticked.
+*/
+uint8_t anim_cathode_due(void)
+{
+	time_s now;
+	uint8_t hour;
+
+	rtc_get_time(&now);
+	if (running || now.sec || now.min)
+		return FALSE;
+	hour = settings_get(SET_CATHODE_HOUR);
+	if (hour == ANIM_EVERY_HOUR)
+		return TRUE;
+	return (rtc_hour24(&now) == hour);
+}
+
+/*===========================================================================*/
+void anim_cathode_start(void)
+{
+	running = TRUE;
+	pass = 0;
+	idx = 0;
+	anim_shuffle();
+	// every cathode gets the full mux slot while cycling
+	timer_fade_set(0);
+}
+
+/*===========================================================================*/
+/*
+* One step of the cathode exercise, to be called every ANIM_DIGIT_MS. Returns
+* FALSE once it is over and the display can go back to the time.
+*/
+uint8_t anim_cathode_run(void)
+{
+	display_s d;
+
+	if (!running)
+		return FALSE;
+
+	if (pass == ANIM_PASSES) {
+		running = FALSE;
+		// from the settings, so a fade set from the console meanwhile holds
+		timer_fade_set(settings_get(SET_FADE_MS));
+		return FALSE;
+	}
+
+	d.mode = ON;
+	d.d1 = digit[0];
+	d.d2 = digit[1];
+	d.d3 = digit[2];
+	d.d4 = digit[3];
+	timer_display_set(&d);
+
+	for (uint8_t t = 0; t < 4; t++) {
+		digit[t] += stride[t];
+		if (digit[t] > 9) digit[t] -= 10;
+	}
+	if (++idx == 10) {
+		idx = 0;
+		pass++;
+		anim_shuffle();
+	}
+
+	return TRUE;
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* New random order for every tube: a random first digit and a random step
+* from anim_strides[], so each pass is a different permutation of 0-9.
+*/
+static void anim_shuffle(void)
+{
+	for (uint8_t t = 0; t < 4; t++) {
+		digit[t] = random_number(10);
+		stride[t] = pgm_read_byte(&anim_strides[random_number(4)]);
+	}
+}
@@ -0,0 +1,31 @@
+
+#ifndef ANIM_H
+#define ANIM_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define ANIM_DIGIT_MS		80		// cathode exercise: time per digit
+
+// Default hour of the cathode exercise (0-23), or every hour
+#define ANIM_EVERY_HOUR		0xFF
+#ifndef ANIM_CATHODE_HOUR
+#define ANIM_CATHODE_HOUR	ANIM_EVERY_HOUR
+#endif
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+uint8_t anim_cathode_due(void);
+void anim_cathode_start(void);
+uint8_t anim_cathode_run(void);
+
+#endif	/* ANIM_H */
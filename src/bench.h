@@ -0,0 +1,34 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "hal.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* Benchmark markers, compiled in with -DBENCH ('make bench').
+* PB4 (MISO on the ISP header) is held high while the main loop is busy, so
+* the simulator (tools/bench) or a scope can measure its time per 1ms slot.
+* PORTB is shared with the mux ISR's anode bits, so the read-modify-writes
+* run with interrupts off.
+* With -DBENCH_FADE as well ('make bench_fade') every mux slot cross-fades
+* at the last fade step, so COMPA takes its fade path and COMPB fires at 20
+* counts (1280 cycles) into every slot: the worst case for both vectors.
+*/
+#ifdef BENCH
+#define BENCH_INIT()	(DDRB |= (1<<DDB4))
+#define BENCH_BUSY()	do { ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { PORTB |= (1<<PORTB4); } } while (0)
+#define BENCH_IDLE()	do { ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { PORTB &= ~(1<<PORTB4); } } while (0)
+#else
+#define BENCH_INIT()
+#define BENCH_BUSY()
+#define BENCH_IDLE()
+#endif
+
+#endif	/* BENCH_H */
@@ -0,0 +1,150 @@
+/**
+ * @file button.c
+ * @brief Push button debouncing and events
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "button.h"
+#include "config.h"
+#include "trace.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+// Button time counts, in milliseconds (button_scan() calls)
+#define BTN_HOLD_TIME		300		// press turns into a hold
+#define BTN_REPEAT_TIME		65		// repeat period while held
+#define BTN_LONG_TIME		2000	// long hold
+
+#define BTN_QUEUE_LEN		8		// power of 2
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+/*
+* Debouncer: bit n is button n+1. cnt0..cnt2 are the bits of one 3 bit
+* counter per button ("vertical" counters), so all buttons are debounced
+* with a handful of byte operations. A button changes state after 7
+* consecutive samples that differ from it.
+*/
+static uint8_t state;				// debounced buttons
+static uint8_t cnt0, cnt1, cnt2;	// vertical counter bits
+
+// The ladder reads one key at a time, so one hold timer covers them all
+static uint8_t held;				// button being timed, 0: none
+static uint16_t held_ms;			// ms since it was pressed, up to BTN_LONG_TIME
+static uint8_t rep_ms;				// ms since the last HOLD / REPEAT
+
+static uint8_t queue[BTN_QUEUE_LEN];
+static uint8_t q_head, q_tail;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static void button_post(uint8_t type, uint8_t n);
+
+/*===========================================================================*/
+void button_init(void)
+{
+	state = 0;
+	cnt0 = cnt1 = cnt2 = 0;
+	held = 0;
+	held_ms = 0;
+	rep_ms = 0;
+	q_head = q_tail = 0;
+}
+
+/*===========================================================================*/
+/*
+* Debounces one sample of the keypad and posts the resulting events. To be
+* called every 1ms with the key read by adc_key_press() (1-4, 5: none).
+*/
+void button_scan(uint8_t key)
+{
+	uint8_t raw, delta, toggle;
+
+	raw = (key >= 1 && key <= 4) ? (1 << (key - 1)) : 0;
+
+	// count up where the sample differs from the debounced state,
+	// clear the counter everywhere else
+	delta = raw ^ state;
+	cnt2 = (cnt2 ^ (cnt1 & cnt0)) & delta;
+	cnt1 = (cnt1 ^ cnt0) & delta;
+	cnt0 = ~cnt0 & delta;
+	toggle = delta & cnt0 & cnt1 & cnt2;	// counter reached 7
+	state ^= toggle;
+
+	if (toggle) {
+		for (uint8_t n = 1; n <= 4; n++) {
+			if (!(toggle & (1 << (n - 1))))
+				continue;
+			if (state & (1 << (n - 1))) {
+				held = n;
+				held_ms = 0;
+				button_post(BTN_PRESS, n);
+			} else if (held == n) {
+				if (held_ms < BTN_HOLD_TIME)
+					button_post(BTN_SHORT_RELEASE, n);
+				held = 0;
+			}
+		}
+	}
+
+	if (!held)
+		return;
+
+	if (held_ms <= BTN_LONG_TIME)
+		held_ms++;
+
+	if (held_ms == BTN_HOLD_TIME) {
+		rep_ms = 0;
+		button_post(BTN_HOLD, held);
+	} else if ((held_ms > BTN_HOLD_TIME) && (++rep_ms == BTN_REPEAT_TIME)) {
+		rep_ms = 0;
+		button_post(BTN_REPEAT, held);
+	}
+	if (held_ms == BTN_LONG_TIME)
+		button_post(BTN_LONG_HOLD, held);
+}
+
+/*===========================================================================*/
+/*
+* Oldest pending event, BTN_NONE when there is none.
+*/
+uint8_t button_get_event(void)
+{
+	uint8_t ev;
+
+	if (q_head == q_tail)
+		return BTN_NONE;
+
+	ev = queue[q_tail];
+	q_tail = (q_tail + 1) & (BTN_QUEUE_LEN - 1);
+	return ev;
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Queues an event. When the queue is full the event is dropped.
+*/
+static void button_post(uint8_t type, uint8_t n)
+{
+	uint8_t next = (q_head + 1) & (BTN_QUEUE_LEN - 1);
+
+	if (next == q_tail)
+		return;
+
+	TRACE_EVENT(TRC_BTN, BTN_EVENT(type, n));
+	queue[q_head] = BTN_EVENT(type, n);
+	q_head = next;
+}
@@ -0,0 +1,36 @@
+
+#ifndef BUTTON_H
+#define BUTTON_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+// Event types
+#define BTN_NONE			0		// event queue empty
+#define BTN_PRESS			1		// debounced press
+#define BTN_SHORT_RELEASE	2		// released before BTN_HOLD
+#define BTN_HOLD			3		// held for BTN_HOLD_TIME
+#define BTN_REPEAT			4		// every BTN_REPEAT_TIME after BTN_HOLD
+#define BTN_LONG_HOLD		5		// held for BTN_LONG_TIME
+
+// An event is one byte: type in the high nibble, button (1-4) in the low one
+#define BTN_EVENT(type, n)	(((type) << 4) | (n))
+#define BTN_EV_TYPE(ev)		((ev) >> 4)
+#define BTN_EV_KEY(ev)		((ev) & 0x0F)
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void button_init(void);
+void button_scan(uint8_t key);
+uint8_t button_get_event(void);
+
+#endif	/* BUTTON_H */
@@ -34,6 +34,8 @@
 #define BLANK 		0xFF
 
 // NULL pointer
+#ifndef NULL
 #define NULL 			((void *)0)
+#endif
 
 #endif	/* MAIN_H */
\ No newline at end of file
@@ -0,0 +1,464 @@
+/**
+ * @file console.c
+ * @brief Line oriented command console on the UART
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "console.h"
+#include "anim.h"
+#include "config.h"
+#include "i2c.h"
+#include "proto.h"
+#include "rtc.h"
+#include "sched.h"
+#include "settings.h"
+#include "timers.h"
+#include "uart.h"
+
+#include "hal.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define CON_WORD_LEN		8		// command names: up to 7 chars + NUL
+#define CON_ARGS			3		// numeric arguments
+#define CON_ARG_MAX			255		// arguments fit a byte
+
+/*
+* Longest output of each command, the TX room it needs before it runs (plus
+* CON_END_MAX for the OK/ERR line). Worst case values; the whole of
+* 'tasks' with SCHED_MAX_TASKS rows must fit the TX ring with CON_END_MAX.
+*/
+#define CON_END_MAX			(sizeof("ERR\r\n") - 1)
+#define CON_HELP_REPLY		(sizeof("help time date stats tasks mode fade cathode \r\n") - 1)
+#define CON_TIME_REPLY		(sizeof("hh:mm:ss\r\n") - 1)
+#define CON_DATE_REPLY		(sizeof("yy-mm-dd w\r\n") - 1)
+#define CON_STATS_REPLY		(sizeof("i2c txn 65535 err 65535 retry 65535 tmo 65535 rec 65535\r\n" \
+								"uart ovr 65535 drop 65535\r\n" "drift -32768\r\n" \
+								"mux lat 255\r\n") - 1)
+#define CON_TASKS_REPLY		(SCHED_MAX_TASKS * (sizeof("7 65535 65535\r\n") - 1))
+#define CON_FADE_REPLY		(sizeof("65535\r\n") - 1)
+#define CON_CATHODE_REPLY	(sizeof("24\r\n") - 1)
+
+// 'ready' values
+#define CON_READY_LINE		1
+#define CON_READY_FRAME		2
+#define CON_FADE_MAX		SET_FADE_MAX	// ms per fade step
+#define CON_CATHODE_EVERY	24		// 'cathode' hour for ANIM_EVERY_HOUR
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S *****************
+******************************************************************************/
+
+typedef struct {
+	char name[CON_WORD_LEN];
+	uint8_t min_args;
+	uint8_t max_args;
+	uint8_t reply;			// longest output, without OK/ERR
+	uint8_t (*run)(void);	// TRUE: OK, FALSE: ERR
+} con_cmd_s;
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+/*
+* Parser state. Bytes are consumed as they arrive: the command word is
+* collected, the numbers are accumulated digit by digit, so no line buffer
+* is kept.
+*/
+static char word[CON_WORD_LEN];
+static uint8_t wlen;
+static uint8_t word_done;			// flag; separator seen after the word
+static uint16_t args[CON_ARGS];
+static uint8_t nargs;
+static uint8_t in_num;				// flag; digits of args[nargs - 1] coming in
+static uint8_t bad;					// flag; line can't be a valid command
+static uint8_t ready;				// line or frame complete, waiting for TX room
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static uint8_t con_feed(uint8_t c);
+static void con_reset(void);
+static uint8_t con_room(uint8_t done);
+static void con_run(uint8_t done);
+static void con_exec(void);
+static const con_cmd_s * con_find(void);
+static uint8_t con_match(const char *name);
+static void con_put2(uint8_t v);
+static uint8_t con_help(void);
+static uint8_t con_time(void);
+static uint8_t con_date(void);
+static uint8_t con_stats(void);
+static uint8_t con_tasks(void);
+static uint8_t con_mode(void);
+static uint8_t con_fade(void);
+static uint8_t con_cathode(void);
+
+static const con_cmd_s commands[] PROGMEM = {
+	{ "help",	0, 0, CON_HELP_REPLY,	con_help },
+	{ "time",	0, 3, CON_TIME_REPLY,	con_time },
+	{ "date",	0, 0, CON_DATE_REPLY,	con_date },
+	{ "stats",	0, 0, CON_STATS_REPLY,	con_stats },
+	{ "tasks",	0, 0, CON_TASKS_REPLY,	con_tasks },
+	{ "mode",	1, 1, 0,				con_mode },
+	{ "fade",	0, 1, CON_FADE_REPLY,	con_fade },
+	{ "cathode",	0, 1, CON_CATHODE_REPLY,	con_cathode },
+};
+#define N_COMMANDS		(sizeof(commands) / sizeof(commands[0]))
+
+/*===========================================================================*/
+void console_init(void)
+{
+	con_reset();
+	proto_init();
+	ready = FALSE;
+}
+
+/*===========================================================================*/
+/*
+* Scheduler task. Feeds the received bytes to the frame parser (src/proto.c)
+* and, when they aren't frame bytes, to the line parser; runs complete lines
+* and frames. A command only runs once its longest reply fits in the TX
+* ring; until then it is held and the input left in the RX ring, so a slow
+* host throttles the console instead of the main loop.
+*/
+void console_service(void)
+{
+	uint8_t c;
+	uint8_t gap;
+	uint8_t done;
+
+	if (ready) {
+		if (uart_tx_free() < con_room(ready))
+			return;
+		con_run(ready);
+		ready = FALSE;
+	}
+
+	while (uart_getc(&c, &gap)) {
+		switch (proto_feed(c, gap)) {
+			case PROTO_NONE:
+				if (!con_feed(c))
+					continue;
+				done = CON_READY_LINE;
+				break;
+			case PROTO_FRAME:
+				done = CON_READY_FRAME;
+				break;
+			default:
+				continue;
+		}
+		if (uart_tx_free() < con_room(done)) {
+			ready = done;
+			return;
+		}
+		con_run(done);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Parses one byte. TRUE once a non-empty line is complete.
+*/
+static uint8_t con_feed(uint8_t c)
+{
+	if ((c == '\r') || (c == '\n'))
+		return (wlen != 0) || bad;
+
+	if ((c >= 'A') && (c <= 'Z'))
+		c += 'a' - 'A';
+
+	if ((c >= 'a') && (c <= 'z')) {
+		if (word_done || in_num || (wlen == CON_WORD_LEN - 1))
+			bad = TRUE;
+		else
+			word[wlen++] = c;
+	} else if ((c >= '0') && (c <= '9')) {
+		if (!in_num) {
+			if ((wlen == 0) || (nargs == CON_ARGS)) {
+				bad = TRUE;
+				return FALSE;
+			}
+			args[nargs++] = 0;
+			in_num = TRUE;
+		}
+		args[nargs - 1] = (args[nargs - 1] * 10) + (c - '0');
+		if (args[nargs - 1] > CON_ARG_MAX) {
+			args[nargs - 1] = 0;
+			bad = TRUE;
+		}
+	} else if ((c == ' ') || (c == ':') || (c == '\t')) {
+		if (wlen)
+			word_done = TRUE;
+		in_num = FALSE;
+	} else {
+		bad = TRUE;
+	}
+	return FALSE;
+}
+
+/*===========================================================================*/
+static void con_reset(void)
+{
+	wlen = 0;
+	word_done = FALSE;
+	nargs = 0;
+	in_num = FALSE;
+	bad = FALSE;
+}
+
+/*===========================================================================*/
+/*
+* TX room the complete line or frame 'done' (CON_READY_*) needs for its
+* reply.
+*/
+static uint8_t con_room(uint8_t done)
+{
+	const con_cmd_s *cmd;
+
+	if (done == CON_READY_FRAME)
+		return PROTO_REPLY_MAX;
+	cmd = con_find();
+	if (cmd == NULL)
+		return CON_END_MAX;
+	return pgm_read_byte(&cmd->reply) + CON_END_MAX;
+}
+
+/*===========================================================================*/
+static void con_run(uint8_t done)
+{
+	if (done == CON_READY_FRAME) proto_exec();
+	else con_exec();
+}
+
+/*===========================================================================*/
+/*
+* Runs the parsed line and ends the reply with OK or ERR.
+*/
+static void con_exec(void)
+{
+	uint8_t ok = FALSE;
+	const con_cmd_s *cmd = con_find();
+	uint8_t (*run)(void);
+
+	if ((cmd != NULL) &&
+		(nargs >= pgm_read_byte(&cmd->min_args)) &&
+		(nargs <= pgm_read_byte(&cmd->max_args))) {
+		run = (uint8_t (*)(void))pgm_read_ptr(&cmd->run);
+		ok = run();
+	}
+
+	uart_puts_P(ok ? PSTR("OK\r\n") : PSTR("ERR\r\n"));
+	con_reset();
+}
+
+/*===========================================================================*/
+/*
+* Table entry of the parsed command word, NULL if unknown or the line is bad.
+*/
+static const con_cmd_s * con_find(void)
+{
+	if (bad)
+		return NULL;
+	for (uint8_t i = 0; i < N_COMMANDS; i++)
+		if (con_match(commands[i].name))
+			return &commands[i];
+	return NULL;
+}
+
+/*===========================================================================*/
+/*
+* TRUE if the command word is 'name' (program memory).
+*/
+static uint8_t con_match(const char *name)
+{
+	for (uint8_t j = 0; j < wlen; j++)
+		if (pgm_read_byte(&name[j]) != word[j])
+			return FALSE;
+	return pgm_read_byte(&name[wlen]) == '\0';
+}
+
+/*===========================================================================*/
+/*
+* Two decimal digits, 'v' up to 99.
+*/
+static void con_put2(uint8_t v)
+{
+	uart_putc('0' + (v / 10));
+	uart_putc('0' + (v % 10));
+}
+
+/*===========================================================================*/
+static uint8_t con_help(void)
+{
+	for (uint8_t i = 0; i < N_COMMANDS; i++) {
+		uart_puts_P(commands[i].name);
+		uart_putc(' ');
+	}
+	uart_puts_P(PSTR("\r\n"));
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* "time": hh:mm:ss, 24h. "time hh mm [ss]": sets it, keeping the hour mode.
+*/
+static uint8_t con_time(void)
+{
+	time_s t;
+
+	if (nargs == 0) {
+		rtc_get_time(&t);
+		con_put2(rtc_hour24(&t));
+		uart_putc(':');
+		uart_put_bcd(t.min);
+		uart_putc(':');
+		uart_put_bcd(t.sec);
+		uart_puts_P(PSTR("\r\n"));
+		return TRUE;
+	}
+	if (nargs == 1)
+		return FALSE;
+
+	rtc_get_time(&t);
+	return rtc_set_time(args[0], args[1], (nargs == 3) ? args[2] : 0,
+		(t.hour & TIME_12H) != 0) == I2C_OK;
+}
+
+/*===========================================================================*/
+static uint8_t con_date(void)
+{
+	date_s d;
+
+	rtc_get_date(&d);
+	con_put2(d.year);
+	uart_putc('-');
+	con_put2(d.month);
+	uart_putc('-');
+	con_put2(d.day);
+	uart_putc(' ');
+	uart_putc('0' + d.wday);
+	uart_puts_P(PSTR("\r\n"));
+	return TRUE;
+}
+
+/*===========================================================================*/
+static uint8_t con_stats(void)
+{
+	volatile i2c_stats_s *i2c = i2c_get_stats_handler();
+	volatile uart_stats_s *uart = uart_get_stats_handler();
+	int16_t drift = rtc_get_drift();
+
+	uart_puts_P(PSTR("i2c txn "));
+	uart_put_dec(i2c->txns);
+	uart_puts_P(PSTR(" err "));
+	uart_put_dec(i2c->errors);
+	uart_puts_P(PSTR(" retry "));
+	uart_put_dec(i2c->retries);
+	uart_puts_P(PSTR(" tmo "));
+	uart_put_dec(i2c->timeouts);
+	uart_puts_P(PSTR(" rec "));
+	uart_put_dec(i2c->recoveries);
+	uart_puts_P(PSTR("\r\nuart ovr "));
+	uart_put_dec(uart->rx_overruns);
+	uart_puts_P(PSTR(" drop "));
+	uart_put_dec(uart->tx_drops);
+	uart_puts_P(PSTR("\r\ndrift "));
+	if (drift < 0) {
+		uart_putc('-');
+		drift = -drift;
+	}
+	uart_put_dec(drift);
+	uart_puts_P(PSTR("\r\nmux lat "));
+	uart_put_dec(timer_get_max_latency());
+	uart_puts_P(PSTR("\r\n"));
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* One line per task: index, runs, longest run (Timer 0 counts, 4us).
+*/
+static uint8_t con_tasks(void)
+{
+	volatile task_stats_s *s;
+
+	for (uint8_t i = 0; (s = sched_get_stats_handler(i)) != NULL; i++) {
+		uart_putc('0' + i);
+		uart_putc(' ');
+		uart_put_dec(s->runs);
+		uart_putc(' ');
+		uart_put_dec(s->max);
+		uart_puts_P(PSTR("\r\n"));
+	}
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* "mode 12" / "mode 24": rewrites the current time in the new hour mode and
+* stores the choice.
+*/
+static uint8_t con_mode(void)
+{
+	uint8_t mode_12h;
+
+	if ((args[0] != 12) && (args[0] != 24))
+		return FALSE;
+	mode_12h = (args[0] == 12);
+
+	if (rtc_set_hour_mode(mode_12h) != I2C_OK)
+		return FALSE;
+	settings_set(SET_HOUR_12H, mode_12h);
+	return TRUE;
+}
+
+/*===========================================================================*/
+static uint8_t con_fade(void)
+{
+	if (nargs == 0) {
+		uart_put_dec(timer_get_fade());
+		uart_puts_P(PSTR("\r\n"));
+		return TRUE;
+	}
+	if (args[0] > CON_FADE_MAX)
+		return FALSE;
+
+	timer_fade_set(args[0]);
+	settings_set(SET_FADE_MS, args[0]);
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* "cathode": hour of the cathode exercise, 24 for every hour. "cathode hh"
+* sets and stores it (0-23, or 24).
+*/
+static uint8_t con_cathode(void)
+{
+	uint8_t hour;
+
+	if (nargs == 0) {
+		hour = settings_get(SET_CATHODE_HOUR);
+		uart_put_dec((hour == ANIM_EVERY_HOUR) ? CON_CATHODE_EVERY : hour);
+		uart_puts_P(PSTR("\r\n"));
+		return TRUE;
+	}
+	if (args[0] > CON_CATHODE_EVERY)
+		return FALSE;
+
+	settings_set(SET_CATHODE_HOUR,
+		(args[0] == CON_CATHODE_EVERY) ? ANIM_EVERY_HOUR : args[0]);
+	return TRUE;
+}
@@ -0,0 +1,40 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define CONSOLE_POLL_MS		2		// RX ring fill time at 115200 baud: ~2.8ms
+
+/*
+* Line oriented command console on the UART (115200 8N1, no echo). A command
+* word, then up to 3 numbers separated by spaces or ':'; lines end
+* with CR and/or LF. Replies end with "OK" or "ERR". Binary frames for
+* tools share the line, see proto.h.
+*	help					command list
+*	time					current time, hh:mm:ss
+*	time hh mm [ss]			set the time (24h), seconds default to 0
+*	date					date of the last RTC read, yy-mm-dd weekday
+*	stats					I2C and UART counters, last RTC drift, worst
+*							mux ISR latency (Timer 0 counts, 4us)
+*	tasks					scheduler task statistics
+*	mode 12|24				hour mode
+*	fade [ms]				cross-fade step, 0: off
+*	cathode [hh]			hour of the cathode exercise, 24: every hour
+*/
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void console_init(void);
+void console_service(void);
+
+#endif	/* CONSOLE_H */
@@ -0,0 +1,25 @@
+#ifndef HAL_H
+#define HAL_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+/*
+* Hardware abstraction layer. Firmware modules include this file instead of
+* the avr-libc headers.
+* - AVR backend (default): register names come from <avr/io.h> and the hal_*
+*   calls are always_inline wrappers of single register accesses, so they
+*   compile to the register accesses, with no call, at any optimization
+*   level.
+* - Host backend (-DHAL_HOST, 'make host'): ports and configuration
+*   registers are plain variables; TWI, ADC, timers and interrupts are
+*   simulated by host/hal_host.c on top of POSIX signals.
+*/
+#ifdef HAL_HOST
+#include "hal_host.h"
+#else
+#include "hal_avr.h"
+#endif
+
+#endif	/* HAL_H */
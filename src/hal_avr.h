@@ -0,0 +1,222 @@
+#ifndef HAL_AVR_H
+#define HAL_AVR_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* Accessors are inlined even at the makefile's -O0, where plain 'static
+* inline' is not: an ISR using them makes no calls, so it doesn't have to
+* save the whole call-clobbered register set.
+*/
+#define HAL_INLINE				static inline __attribute__((always_inline))
+
+// Interrupts
+#define HAL_ISR(vector)			ISR(vector)
+#define HAL_ISR_NAKED(vector)	ISR(vector, ISR_NAKED)	// no prologue/epilogue, AVR only
+#define hal_irq_enable()		sei()
+#define hal_irq_disable()		cli()
+#define hal_irq_enabled()		(SREG & (1<<SREG_I))
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/* Sleep --------------------------------------------------------------------*/
+
+/*
+* Idle sleep until the next interrupt; the timers, TWI and ADC keep running.
+* SEI delays interrupts by one instruction, so none can slip in between the
+* caller's last check and SLEEP. Returns with the I flag clear.
+*/
+HAL_INLINE void hal_sleep_idle(void)
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	cli();
+}
+
+/* TWI ----------------------------------------------------------------------*/
+
+HAL_INLINE void hal_twi_init(uint8_t bitrate)
+{
+	TWSR = 0;			// prescaler 1
+	TWBR = bitrate;
+}
+
+HAL_INLINE void hal_twi_control(uint8_t twcr)
+{
+	TWCR = twcr;
+}
+
+HAL_INLINE uint8_t hal_twi_ready(void)
+{
+	return (TWCR & (1<<TWINT));
+}
+
+HAL_INLINE uint8_t hal_twi_stopping(void)
+{
+	return (TWCR & (1<<TWSTO));
+}
+
+HAL_INLINE uint8_t hal_twi_status(void)
+{
+	return (TWSR & 0xF8);
+}
+
+HAL_INLINE void hal_twi_write(uint8_t data)
+{
+	TWDR = data;
+}
+
+HAL_INLINE uint8_t hal_twi_read(void)
+{
+	return TWDR;
+}
+
+/*
+* SDA (PC4) and SCL (PC5) by hand, for bus recovery with the TWI off. The
+* lines are open drain: PORT stays low and a line is pulled low by making
+* it an output, released by making it an input.
+*/
+HAL_INLINE void hal_twi_pins_release(void)
+{
+	PORTC &= ~((1<<PORTC4) | (1<<PORTC5));
+	DDRC &= ~((1<<DDC4) | (1<<DDC5));
+}
+
+HAL_INLINE void hal_twi_scl(uint8_t high)
+{
+	if (high) DDRC &= ~(1<<DDC5);
+	else DDRC |= (1<<DDC5);
+}
+
+HAL_INLINE void hal_twi_sda(uint8_t high)
+{
+	if (high) DDRC &= ~(1<<DDC4);
+	else DDRC |= (1<<DDC4);
+}
+
+HAL_INLINE uint8_t hal_twi_sda_read(void)
+{
+	return (PINC & (1<<PINC4));
+}
+
+/* ADC ----------------------------------------------------------------------*/
+
+HAL_INLINE uint16_t hal_adc_read(void)
+{
+	return ADC;
+}
+
+HAL_INLINE uint8_t hal_adc_busy(void)
+{
+	return (ADCSRA & (1<<ADSC));
+}
+
+// Left adjusted result (ADLAR set): 8 MSBs in a single register read
+HAL_INLINE uint8_t hal_adc_read8(void)
+{
+	return ADCH;
+}
+
+// Conversion complete? Clears ADIF, for polling with ADIE set but I clear
+HAL_INLINE uint8_t hal_adc_done(void)
+{
+	if (ADCSRA & (1<<ADIF)) {
+		ADCSRA |= (1<<ADIF);
+		return 1;
+	}
+	return 0;
+}
+
+/* EEPROM -------------------------------------------------------------------*/
+
+HAL_INLINE uint8_t hal_eeprom_read(uint16_t addr)
+{
+	return eeprom_read_byte((const uint8_t *)(uintptr_t)addr);
+}
+
+/*
+* Starts an erase + write of one byte (~3.4ms), with no write in progress
+* (from EE_READY_vect, for instance). EEPE must be set within 4 cycles of
+* EEMPE: two back to back SBIs, as avr-libc's eeprom_write_byte() does, so
+* the timing holds at any optimization level, with interrupts held off
+* between them.
+*/
+HAL_INLINE void hal_eeprom_write(uint16_t addr, uint8_t data)
+{
+	EEAR = addr;
+	EEDR = data;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		__asm__ __volatile__ (
+			"sbi %[eecr], %[eempe]"	"\n\t"
+			"sbi %[eecr], %[eepe]"	"\n\t"
+			:
+			: [eecr] "I" (_SFR_IO_ADDR(EECR)),
+			  [eempe] "I" (EEMPE),
+			  [eepe] "I" (EEPE)
+			: "memory"
+		);
+	}
+}
+
+// EE_READY_vect fires, level triggered, while no write is in progress
+HAL_INLINE void hal_eeprom_irq(uint8_t on)
+{
+	if (on) EECR |= (1<<EERIE);
+	else EECR &= ~(1<<EERIE);
+}
+
+/* UART ---------------------------------------------------------------------*/
+
+// 8N1, double speed: baud = F_CPU / (8 * (ubrr + 1))
+HAL_INLINE void hal_uart_init(uint16_t ubrr)
+{
+	UBRR0 = ubrr;
+	UCSR0A = (1<<U2X0);
+	UCSR0C = (1<<UCSZ01) | (1<<UCSZ00);
+	UCSR0B = (1<<TXEN0) | (1<<RXEN0);
+}
+
+HAL_INLINE void hal_uart_write(uint8_t data)
+{
+	UDR0 = data;
+}
+
+HAL_INLINE uint8_t hal_uart_read(void)
+{
+	return UDR0;
+}
+
+// USART_UDRE_vect fires, level triggered, while the data register is empty
+HAL_INLINE void hal_uart_tx_irq(uint8_t on)
+{
+	if (on) UCSR0B |= (1<<UDRIE0);
+	else UCSR0B &= ~(1<<UDRIE0);
+}
+
+// USART_RX_vect fires, level triggered, until UDR0 is read
+HAL_INLINE void hal_uart_rx_irq(uint8_t on)
+{
+	if (on) UCSR0B |= (1<<RXCIE0);
+	else UCSR0B &= ~(1<<RXCIE0);
+}
+
+#endif	/* HAL_AVR_H */
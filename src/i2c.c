@@ -5,8 +5,10 @@
 
 #include "i2c.h"
 #include "config.h"
+#include "timers.h"
+#include "trace.h"
 
-#include <avr/io.h>
+#include "hal.h"
 
 /******************************************************************************
 ******************* C O N S T A N T   D E F I N I T I O N S *******************
@@ -20,9 +22,10 @@
 #define TW_ACK   (1<<TWINT)|(1<<TWEA)|(1<<TWEN)		// TWCR = 0b11000100: return ACK to slave
 #define TW_NACK  (1<<TWINT)|(1<<TWEN)				// TWCR = 0b10000100: don't return ACK to slave
 #define TW_SEND  (1<<TWINT)|(1<<TWEN)				// TWCR = 0b10000100: send data (TWINT,TWEN)
+#define TW_RESTART (TW_STOP)|(1<<TWSTA)				// TWCR = 0b10110100: stop, then start again
 
-#define TW_READY (TWCR & (1<<TWINT))				// ready when TWINT returns to logic 1.
-#define TW_STATUS (TWSR & 0xF8)						// returns value of status register
+#define TW_READY (hal_twi_ready())					// ready when TWINT returns to logic 1.
+#define TW_STATUS (hal_twi_status())				// returns value of status register
 
 /* I2C Status Codes ---------------------------------------------------------*/
 #define TWSR_MT_START				0x08
@@ -37,10 +40,71 @@
 #define TWSR_MR_DATA_ACK			0x50
 #define TWSR_MR_DATA_NACK			0x58
 
+/* Transaction queue --------------------------------------------------------*/
+#define I2C_QUEUE_LEN	4		// must be a power of 2
+#define I2C_READ_BIT	0x01	// added to the address for read transactions
+#define I2C_BYTE_BUF	8		// byte API: writes gathered per transaction
+
+/* Bus fault handling -------------------------------------------------------*/
+#define I2C_TIMEOUT_MS		2		// longest wait for one TWINT (a byte takes 0.1ms)
+#define I2C_SPIN_LIMIT		4000	// same, in polls, while the tick is stopped
+#define I2C_RETRIES			3		// per transaction, then I2C_ERROR/I2C_TIMEOUT
+#define I2C_RECOVER_CLOCKS	9		// SCL pulses to free a slave holding SDA
+#define I2C_HALF_BIT_CYCLES	(F_CPU / (2 * F_SCL))	// 5us, 100KHz SCL
+
+/*
+* Half an SCL period of busy wait for the recovery clocks. The cycle count
+* is a constant, so the delay doesn't depend on the optimization level.
+*/
+#ifdef HAL_HOST
+#define i2c_half_bit()		((void)0)	// no bus timing on the host
+#else
+#define i2c_half_bit()		__builtin_avr_delay_cycles(I2C_HALF_BIT_CYCLES)
+#endif
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static i2c_txn_s * volatile queue[I2C_QUEUE_LEN];
+static volatile uint8_t q_head = 0;		// next descriptor to run
+static volatile uint8_t q_tail = 0;		// next free slot
+
+static i2c_txn_s * volatile txn = NULL;	// transaction on the bus
+static uint8_t idx;						// byte index within wr_buf/rd_buf
+static uint8_t rd_phase;				// flag; write phase done, reading
+static volatile uint8_t steps = 0;		// engine steps, progress marker
+
+static uint8_t last_steps;				// i2c_service() watchdog state
+static uint16_t op_tick;
+
+static i2c_txn_s * volatile backoff = NULL;	// failed transaction waiting to retry
+static volatile uint16_t backoff_tick;		// when it's due
+
+static volatile i2c_stats_s stats;
+
+/*
+* Byte API session: the bytes written since the last START, sent as one
+* transaction by the call that needs them on the bus.
+*/
+static uint8_t bw_addr;					// device's bus address + w
+static uint8_t bw_buf[I2C_BYTE_BUF];
+static uint8_t bw_len;
+
 /******************************************************************************
 ******************* F U N C T I O N   D E F I N I T I O N S *******************
 ******************************************************************************/
 
+static int8_t i2c_byte_flush(void);
+static int8_t i2c_wait(void);
+static int8_t i2c_push(i2c_txn_s *t);
+static void i2c_engine_start(void);
+static void i2c_engine_step(void);
+static void i2c_engine_finish(uint8_t status);
+static void i2c_engine_fail(i2c_txn_s *t, uint8_t status);
+static void i2c_engine_abort(void);
+static void i2c_engine_poll(void);
+
 /*===========================================================================*/
 /*
 * at 16 MHz, the SCL frequency will be 16/(16+2(TWBR)), assuming prescalar of 0.
@@ -48,79 +112,436 @@
 */
 void i2c_init(void)
 {
-   TWSR = 0; // set prescalar to zero
-   TWBR = ((F_CPU/F_SCL)-16)/2; // set SCL frequency in TWI bit register
+   hal_twi_init(((F_CPU/F_SCL)-16)/2); // prescalar to zero, SCL frequency in TWBR
 }
 
 /*===========================================================================*/
-void i2c_stop(void)
+/*
+* Byte level calls, kept as thin blocking wrappers around i2c_transfer():
+* START / write / repeated START / read sequences map onto transactions.
+* Written bytes are gathered and go out with the next i2c_master_read()
+* (as its write phase, before a repeated start), the next START of a write
+* or i2c_stop(); bus errors show up in that call's return value. Each read
+* is a one byte transaction, relying on the device's address auto
+* increment (DS1307, EEPROMs), so 'last' needs no special handling.
+*/
+int8_t i2c_master_start(uint8_t addr_rw)
 {
-	TWCR = TW_STOP;
+	int8_t err = I2C_OK;
+
+	// repeated start to read from the same device: keep the written bytes
+	// (register pointer) for the read's write phase
+	if (!(addr_rw & I2C_READ_BIT) || ((addr_rw & ~I2C_READ_BIT) != bw_addr))
+		err = i2c_byte_flush();
+	bw_addr = addr_rw & ~I2C_READ_BIT;
+	return err;
 }
 
 /*===========================================================================*/
-int8_t i2c_master_start(uint8_t addr_rw)
+int8_t i2c_master_write(uint8_t data)
+{
+	if (bw_len >= I2C_BYTE_BUF)
+		return I2C_ERR_FULL;
+	bw_buf[bw_len++] = data;
+	return I2C_OK;
+}
+
+/*===========================================================================*/
+/*
+* The byte read goes to 'data'; the return value is only the error code.
+*/
+int8_t i2c_master_read(uint8_t last, uint8_t *data)
+{
+	i2c_txn_s t;
+
+	(void)last;
+	t.addr = bw_addr;
+	t.wr_buf = bw_buf;
+	t.wr_len = bw_len;
+	t.rd_buf = data;
+	t.rd_len = 1;
+	t.callback = NULL;
+	bw_len = 0;
+	return i2c_transfer(&t);
+}
+
+/*===========================================================================*/
+/*
+* Ends the session: sends the bytes written since the last START.
+*/
+int8_t i2c_stop(void)
 {
-	TWCR = TW_START;	// send start condition
-	while (!TW_READY);	// wait for start condition to happen
-	// If status code is not as expected (start successfully sent)
-	if (((TWSR & 0xF8) != TWSR_MT_START) && ((TWSR & 0xF8) != TWSR_MT_REPEATED_START)) {
-		i2c_stop();
-		return -1;
+	return i2c_byte_flush();
+}
+
+/*===========================================================================*/
+/*
+* Frees a bus left stuck by a slave that lost a clock mid byte: with the TWI
+* off, SCL is pulsed until the slave releases SDA, then a STOP is generated
+* by hand. Both lines are driven open drain through the HAL and rely on the
+* external pull-ups. Main context only; it takes about 0.1ms.
+*/
+void i2c_recover(void)
+{
+	uint8_t i;
+
+	hal_twi_control(0);			// TWI off, pins back to PORTC
+	hal_twi_pins_release();
+	i2c_half_bit();
+
+	for (i = 0; (i < I2C_RECOVER_CLOCKS) && !hal_twi_sda_read(); i++) {
+		hal_twi_scl(LOW);
+		i2c_half_bit();
+		hal_twi_scl(HIGH);
+		i2c_half_bit();
 	}
 
-	TWDR = addr_rw;		// load device's bus address + read/write instruction
-	TWCR = TW_SEND;		// and send it
-	while (!TW_READY);	// wait for acknowledge
-	// If status code is not as expected (address not acknowledged)
-	if (((TWSR & 0xF8) != TWSR_MT_SLA_W_ACK) && ((TWSR & 0xF8) != TWSR_MR_SLA_R_ACK)) {
-		i2c_stop();
-		return -1;
+	hal_twi_sda(LOW);			// STOP: SDA rises while SCL is high
+	i2c_half_bit();
+	hal_twi_sda(HIGH);
+	i2c_half_bit();
+
+	i2c_init();
+	stats.recoveries++;
+}
+
+/*===========================================================================*/
+/*
+* Queues a transaction for the interrupt driven engine and returns at once.
+* The caller polls txn->status or waits for txn->callback.
+*/
+int8_t i2c_queue(i2c_txn_s *t)
+{
+	int8_t ret;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t->tries = 0;
+		ret = i2c_push(t);
+		if (ret == I2C_OK) {
+			t->status = I2C_PENDING;
+			stats.txns++;
+			i2c_engine_start();
+		}
 	}
 
-	return 0;
+	return ret;
 }
 
 /*===========================================================================*/
 /*
-* once the I2C communication has started (slave address acknowledged), if
-* there's a bus transmission error, no re-try of individual operations can
-* be performed. Instead, all the communication protocol must re-start again.
-*/	
-int8_t i2c_master_write(uint8_t data)
+* Blocking wrapper around i2c_queue(). With interrupts disabled the engine
+* is stepped from here by polling TWINT, so it is also usable at boot.
+*/
+int8_t i2c_transfer(i2c_txn_s *t)
+{
+	int8_t ret = i2c_queue(t);
+
+	if (ret)
+		return ret;
+
+	while (t->status == I2C_PENDING)
+		i2c_engine_poll();
+
+	if (t->status == I2C_DONE) return I2C_OK;
+	if (t->status == I2C_TIMEOUT) return I2C_ERR_TIMEOUT;
+	return I2C_ERR_NACK;
+}
+
+/*===========================================================================*/
+/*
+* Bus watchdog, run every 1ms from the scheduler (and from the blocking
+* waits). If the engine makes no progress for I2C_TIMEOUT_MS, the
+* transaction on the bus is aborted and the bus recovered. Also puts a
+* failed transaction back in the queue once its backoff has elapsed.
+*/
+void i2c_service(void)
 {
-	TWDR = data; 			// load data to be sent
-	TWCR = TW_SEND; 		// and send it
-	while (!TW_READY); 		// wait to be sent
-	if ((TWSR & 0xF8) != TWSR_MT_DATA_ACK) {
-		i2c_stop();
-		return -1;
+	uint8_t live = hal_irq_enabled();	// ticks only advance with I set
+	uint16_t now = timer_get_ticks();
+	uint8_t stalled = FALSE;
+	i2c_txn_s *t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if ((steps != last_steps) || ((txn == NULL) && !hal_twi_stopping())) {
+			last_steps = steps;
+			op_tick = now;
+		} else if ((uint16_t)(now - op_tick) > I2C_TIMEOUT_MS) {
+			stalled = TRUE;
+		}
 	}
-	
-	return 0;
+
+	if (stalled) {
+		i2c_engine_abort();
+		op_tick = timer_get_ticks();
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t = backoff;
+		if ((t != NULL) && ((!live) || ((int16_t)(now - backoff_tick) >= 0)) &&
+			(i2c_push(t) == I2C_OK))
+			backoff = NULL;
+		i2c_engine_start();		// also if deferred by a slow STOP
+	}
+}
+
+/*===========================================================================*/
+uint8_t i2c_busy(void)
+{
+	return ((txn != NULL) || (backoff != NULL) || (q_head != q_tail));
+}
+
+/*===========================================================================*/
+volatile i2c_stats_s * i2c_get_stats_handler(void)
+{
+	return &stats;
 }
 
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
 /*===========================================================================*/
-uint8_t i2c_master_read(uint8_t last)
+/*
+* Sends the byte API's pending writes, if any, as one transaction.
+*/
+static int8_t i2c_byte_flush(void)
 {
-	uint16_t cnt = 0;
+	i2c_txn_s t;
 
-	if (last == LAST_BYTE)
-		TWCR = TW_NACK;			// read with not-acknowledge
-	else
-		TWCR = TW_ACK;			// read with acknowledge
-	
-	while (!TW_READY) {			// wait to read
-		cnt++;
-		if(cnt == 2000){		// if 2ms have elapsed
-			i2c_stop();
-			return -1;
+	if (bw_len == 0)
+		return I2C_OK;
+	t.addr = bw_addr;
+	t.wr_buf = bw_buf;
+	t.wr_len = bw_len;
+	t.rd_buf = NULL;
+	t.rd_len = 0;
+	t.callback = NULL;
+	bw_len = 0;
+	return i2c_transfer(&t);
+}
+
+/*===========================================================================*/
+/*
+* Waits for TWINT for at most I2C_TIMEOUT_MS. Before interrupts are enabled
+* the tick doesn't run, so the wait is bounded by a poll count instead.
+*/
+static int8_t i2c_wait(void)
+{
+	uint16_t start = timer_get_ticks();
+	uint16_t spin = 0;
+
+	while (!TW_READY) {
+		if (hal_irq_enabled()) {
+			if ((uint16_t)(timer_get_ticks() - start) > I2C_TIMEOUT_MS)
+				break;
+		} else if (++spin >= I2C_SPIN_LIMIT) {
+			break;
+		}
+	}
+	return TW_READY ? I2C_OK : I2C_ERR_TIMEOUT;
+}
+
+/*===========================================================================*/
+/*
+* Appends to the queue. Interrupts must be disabled.
+*/
+static int8_t i2c_push(i2c_txn_s *t)
+{
+	if (((q_tail - q_head) & 0xFF) >= I2C_QUEUE_LEN)
+		return I2C_ERR_FULL;
+
+	queue[q_tail & (I2C_QUEUE_LEN - 1)] = t;
+	q_tail++;
+	return I2C_OK;
+}
+
+/*===========================================================================*/
+/*
+* Puts the next queued transaction on an idle bus. If the previous STOP is
+* still going, it's left for i2c_service() rather than waited for here.
+* Interrupts must be disabled.
+*/
+static void i2c_engine_start(void)
+{
+	if ((txn != NULL) || (q_head == q_tail) || hal_twi_stopping())
+		return;
+
+	txn = queue[q_head & (I2C_QUEUE_LEN - 1)];
+	q_head++;
+	idx = 0;
+	rd_phase = FALSE;
+	steps++;
+	TRACE_EVENT(TRC_I2C_BEGIN, txn->addr);
+	hal_twi_control(TW_START | (1<<TWIE));
+}
+
+/*===========================================================================*/
+/*
+* TWI state machine. Called once per TWINT, either from TWI_vect or from
+* i2c_transfer() when interrupts are disabled.
+*/
+static void i2c_engine_step(void)
+{
+	i2c_txn_s *t = txn;
+
+	steps++;
+	if (t == NULL) {
+		hal_twi_control(TW_STOP);
+		return;
+	}
+
+	switch (TW_STATUS) {
+
+		case TWSR_MT_START:
+		case TWSR_MT_REPEATED_START:
+			// write phase first, unless there's nothing to write
+			if ((!rd_phase) && ((t->wr_len) || (t->rd_len == 0)))
+				hal_twi_write(t->addr);
+			else
+				hal_twi_write(t->addr | I2C_READ_BIT);
+			hal_twi_control(TW_SEND | (1<<TWIE));
+			break;
+
+		case TWSR_MT_SLA_W_ACK:
+		case TWSR_MT_DATA_ACK:
+			if (idx < t->wr_len) {
+				hal_twi_write(t->wr_buf[idx++]);
+				hal_twi_control(TW_SEND | (1<<TWIE));
+			} else if (t->rd_len) {
+				idx = 0;
+				rd_phase = TRUE;
+				hal_twi_control(TW_START | (1<<TWIE));
+			} else {
+				i2c_engine_finish(I2C_DONE);
+			}
+			break;
+
+		case TWSR_MR_SLA_R_ACK:
+			idx = 0;
+			if (t->rd_len > 1) hal_twi_control(TW_ACK | (1<<TWIE));
+			else hal_twi_control(TW_NACK | (1<<TWIE));
+			break;
+
+		case TWSR_MR_DATA_ACK:
+			t->rd_buf[idx++] = hal_twi_read();
+			if (idx < (t->rd_len - 1)) hal_twi_control(TW_ACK | (1<<TWIE));
+			else hal_twi_control(TW_NACK | (1<<TWIE));
+			break;
+
+		case TWSR_MR_DATA_NACK:
+			t->rd_buf[idx] = hal_twi_read();
+			i2c_engine_finish(I2C_DONE);
+			break;
+
+		default:
+			// SLA or data NACK, arbitration lost, bus error
+			i2c_engine_finish(I2C_ERROR);
+			break;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Takes a stalled transaction off the bus, recovers the bus and retries or
+* fails the transaction. Main context only.
+*/
+static void i2c_engine_abort(void)
+{
+	i2c_txn_s *t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		hal_twi_control(0);		// no more TWI_vect for it
+		t = txn;
+		txn = NULL;
+	}
+
+	stats.timeouts++;
+	i2c_recover();
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (t != NULL) {
+			TRACE_EVENT(TRC_I2C_END, I2C_TIMEOUT);
+			i2c_engine_fail(t, I2C_TIMEOUT);
 		}
+		i2c_engine_start();
+	}
+}
+
+/*===========================================================================*/
+/*
+* One step of the blocking waits: steps the engine by hand if interrupts are
+* off, and runs the watchdog.
+*/
+static void i2c_engine_poll(void)
+{
+	if (!hal_irq_enabled() && (txn != NULL)) {
+		if (i2c_wait() == I2C_OK)
+			i2c_engine_step();
+		else
+			i2c_engine_abort();
+	}
+	i2c_service();
+}
+
+/*===========================================================================*/
+/*
+* Ends the current transaction and chains the next queued one, if any,
+* with a single STOP + START.
+*/
+static void i2c_engine_finish(uint8_t status)
+{
+	i2c_txn_s *t = txn;
+
+	TRACE_EVENT(TRC_I2C_END, status);
+	if (q_head != q_tail) {
+		txn = queue[q_head & (I2C_QUEUE_LEN - 1)];
+		q_head++;
+		idx = 0;
+		rd_phase = FALSE;
+		TRACE_EVENT(TRC_I2C_BEGIN, txn->addr);
+		hal_twi_control(TW_RESTART | (1<<TWIE));
+	} else {
+		txn = NULL;
+		hal_twi_control(TW_STOP);
+	}
+
+	if (status == I2C_DONE) {
+		t->status = status;
+		if (t->callback)
+			t->callback(t);
+	} else {
+		i2c_engine_fail(t, status);
+	}
+}
+
+/*===========================================================================*/
+/*
+* Parks a failed transaction for a retry after 1, 2, 4ms... or, once out of
+* retries (or if another one is already parked), ends it with 'status'.
+* Interrupts must be disabled.
+*/
+static void i2c_engine_fail(i2c_txn_s *t, uint8_t status)
+{
+	if ((t->tries < I2C_RETRIES) && (backoff == NULL)) {
+		backoff_tick = timer_get_ticks() + (1 << t->tries);
+		t->tries++;
+		backoff = t;
+		stats.retries++;
+		return;
 	}
 
-	if (((last == LAST_BYTE) && ((TWSR & 0xF8) != TWSR_MR_DATA_NACK)) ||
-		((last == NOT_LAST_BYTE) && ((TWSR & 0xF8) != TWSR_MR_DATA_ACK)))
-		return -1;
+	stats.errors++;
+	t->status = status;
+	if (t->callback)
+		t->callback(t);
+}
+
+/******************************************************************************
+********************* I N T E R R U P T   H A N D L E R S *********************
+******************************************************************************/
 
-	return TWDR;
-}
\ No newline at end of file
+/*===========================================================================*/
+HAL_ISR (TWI_vect)
+{
+	i2c_engine_step();
+}
@@ -1,4 +1,3 @@
-
 #ifndef I2C_H
 #define I2C_H
 
@@ -12,18 +11,76 @@
 ******************* C O N S T A N T   D E F I N I T I O N S *******************
 ******************************************************************************/
 
-// I2C Misc Codes
+// i2c_master_read() 'last' argument
 #define LAST_BYTE				1
 #define NOT_LAST_BYTE			0
 
+// Transaction status
+#define I2C_IDLE				0x00	// descriptor not queued
+#define I2C_PENDING				0x01	// queued or on the bus
+#define I2C_DONE				0x02	// finished successfully
+#define I2C_ERROR				0x03	// NACK, arbitration lost or bus error
+#define I2C_TIMEOUT				0x04	// bus stalled, recovered
+
+// Return codes, never mixed with data
+#define I2C_OK					0
+#define I2C_ERR_NACK			-1		// not acknowledged, unexpected bus state
+#define I2C_ERR_TIMEOUT			-2		// no TWINT within I2C_TIMEOUT_MS
+#define I2C_ERR_FULL			-3		// transaction queue full
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S *****************
+******************************************************************************/
+
+/*
+* Transaction descriptor. 'wr_len' bytes from 'wr_buf' are sent to the
+* device first; then, if 'rd_len' is not zero, a repeated start is issued
+* and 'rd_len' bytes are read into 'rd_buf'. The descriptor and its buffers
+* must stay alive until 'status' leaves I2C_PENDING. 'callback' (optional)
+* is called from the TWI interrupt once the transaction ends.
+*/
+typedef struct i2c_txn i2c_txn_s;
+
+struct i2c_txn {
+	uint8_t addr;						// device's bus address + w
+	uint8_t *wr_buf;
+	uint8_t wr_len;
+	uint8_t *rd_buf;
+	uint8_t rd_len;
+	volatile uint8_t status;			// I2C_IDLE, I2C_PENDING, I2C_DONE...
+	uint8_t tries;						// retries so far, managed by the engine
+	void (*callback)(i2c_txn_s *txn);
+};
+
+/*
+* Diagnostic counters, never reset. A transaction that needs retries counts
+* once in 'txns' and once per retry in 'retries'; 'errors' are transactions
+* that failed for good.
+*/
+typedef struct {
+	uint16_t txns;
+	uint16_t errors;
+	uint16_t retries;
+	uint16_t timeouts;
+	uint16_t recoveries;
+} i2c_stats_s;
+
 /******************************************************************************
 ******************** F U N C T I O N   P R O T O T Y P E S ********************
 ******************************************************************************/
 
 void i2c_init(void);
-void i2c_stop(void);
+void i2c_recover(void);
+
 int8_t i2c_master_start(uint8_t addr_rw);
 int8_t i2c_master_write(uint8_t data);
-uint8_t i2c_master_read(uint8_t last);
+int8_t i2c_master_read(uint8_t last, uint8_t *data);
+int8_t i2c_stop(void);
+
+int8_t i2c_queue(i2c_txn_s *txn);
+int8_t i2c_transfer(i2c_txn_s *txn);
+void i2c_service(void);
+uint8_t i2c_busy(void);
+volatile i2c_stats_s * i2c_get_stats_handler(void);
 
-#endif 	/* I2C_H */
\ No newline at end of file
+#endif 	/* I2C_H */
@@ -5,12 +5,20 @@
 
 #include "init.h"
 #include "adc.h"
+#include "bench.h"
+#include "button.h"
+#include "console.h"
 #include "config.h"
 #include "i2c.h"
 #include "rtc.h"
+#include "settings.h"
 #include "timers.h"
+#include "uart.h"
+#include "prof.h"
+#include "trace.h"
+#include "util.h"
 
-#include <avr/io.h>
+#include "hal.h"
 
 /******************************************************************************
 ******************* F U N C T I O N   D E F I N I T I O N S *******************
@@ -27,11 +35,24 @@ void boot(void)
 	ports_init();
     timers_init();
     adc_init(TRUE);
+	random_seed(adc_get_noise());
+	button_init();
 	i2c_init();
 	rtc_init();
+	settings_init();
+	timer_fade_set(settings_get(SET_FADE_MS));
+	uart_init();
+	console_init();
+	TRACE_INIT();
+	PROF_INIT();
 
 	timer_ms_set(ENABLE);
 	timer_sec_set(ENABLE);
+	timer_sqw_set(ENABLE);
+
+	// Interrupts stay enabled from here on; shared state is protected with
+	// short ATOMIC_BLOCK sections
+	hal_irq_enable();
 }
 
 /*-----------------------------------------------------------------------------
@@ -61,7 +82,7 @@ static void ports_init(void)
 	PORTB &= ~(1<<PORTB3);
 	PORTD &= ~(1<<PORTD3);
 
-	DDRB &= ~(1<<DDB4);		// not used
+	DDRB &= ~(1<<DDB4);		// not used (main loop busy marker with -DBENCH)
 	DDRB &= ~(1<<DDB5);		// not used
 	DDRC &= ~(1<<DDC0);		// not used
 	DDRC &= ~(1<<DDC1);		// PSH_BTN (Analog in)
@@ -70,12 +91,15 @@ static void ports_init(void)
 	DDRC &= ~(1<<DDC4);		// RTC_SDA
 	DDRC &= ~(1<<DDC5);		// RTC_SCL
 
-	DDRD |= (1<<DDD0);		// not used, TP1, RXD
-	DDRD |= (1<<DDD1);		// not used, TP2, TXD
-	DDRD &= ~(1<<DDD2);		// not used
+	DDRD &= ~(1<<DDD0);		// TP1, RXD (console)
+	DDRD |= (1<<DDD1);		// TP2, TXD (console)
+	DDRD &= ~(1<<DDD2);		// RTC_SQW (1Hz, open drain, INT0)
 	DDRD |= (1<<DDD4);		// PD4, seconds indicator, not used
 
-	PORTD &= ~(1<<PORTD0);
-	PORTD &= ~(1<<PORTD1);	
+	PORTD |= (1<<PORTD0);	// RXD pull-up, idle high when unconnected
+	PORTD |= (1<<PORTD1);	// TXD idle high until the USART takes over
 	PORTD &= ~(1<<PORTD4);
+	PORTD |= (1<<PORTD2);	// RTC_SQW pull-up
+
+	BENCH_INIT();
 }
\ No newline at end of file
@@ -0,0 +1,169 @@
+/**
+ * @file journal.c
+ * @brief Log structured record store in the internal EEPROM
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "journal.h"
+#include "config.h"
+#include "util.h"
+
+#include "hal.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* The EEPROM is a ring of fixed size records, each one written to the slot
+* after the newest. A record is a 16 bit sequence number (LSB first), the
+* payload and a CRC-8 of both; the CRC goes last, so a write cut short by a
+* reset leaves an invalid record and the previous one stands. Every slot
+* takes 1/JRN_SLOTS of the writes.
+*/
+#define JRN_BASE			0x000
+#define JRN_SIZE			1024	// ATmega328 EEPROM
+#define JRN_REC_LEN			(2 + JRN_DATA_LEN + 1)
+#define JRN_SLOTS			(JRN_SIZE / JRN_REC_LEN)
+#define JRN_CRC_INIT		0xA5	// so that an all-zero record is invalid
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static uint16_t seq;					// sequence number of the newest record
+static uint8_t newest;					// its slot
+static uint8_t found;					// flag; there is a valid record
+
+static uint8_t wr_buf[JRN_REC_LEN];		// record being written
+static uint16_t wr_addr;
+static volatile uint8_t wr_idx = JRN_REC_LEN;	// next byte; JRN_REC_LEN: idle
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static uint8_t journal_crc(const uint8_t *rec);
+
+/*===========================================================================*/
+/*
+* Finds the newest valid record, in a single pass over the EEPROM. Sequence
+* numbers are compared modulo 2^16, so they can wrap.
+*/
+void journal_init(void)
+{
+	uint8_t rec[JRN_REC_LEN];
+	uint16_t addr = JRN_BASE;
+	uint16_t s;
+
+	found = FALSE;
+	seq = 0;
+	newest = JRN_SLOTS - 1;		// first write goes to slot 0
+
+	for (uint8_t slot = 0; slot < JRN_SLOTS; slot++) {
+		for (uint8_t i = 0; i < JRN_REC_LEN; i++)
+			rec[i] = hal_eeprom_read(addr++);
+		if (rec[JRN_REC_LEN - 1] != journal_crc(rec))
+			continue;
+		s = rec[0] | ((uint16_t)rec[1] << 8);
+		if ((!found) || ((int16_t)(s - seq) > 0)) {
+			seq = s;
+			newest = slot;
+			found = TRUE;
+		}
+	}
+}
+
+/*===========================================================================*/
+/*
+* Copies up to 'len' bytes of the newest record's payload. FALSE if the
+* journal is empty.
+*/
+uint8_t journal_read(uint8_t *data, uint8_t len)
+{
+	uint16_t addr = JRN_BASE + (newest * JRN_REC_LEN) + 2;
+
+	if (!found)
+		return FALSE;
+	if (len > JRN_DATA_LEN)
+		len = JRN_DATA_LEN;
+	for (uint8_t i = 0; i < len; i++)
+		data[i] = hal_eeprom_read(addr++);
+
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* Appends a record. Returns at once: the bytes go out one per EE_READY_vect,
+* about 3.4ms each. -1 while the previous record is still being written.
+* Missing payload bytes are written as 0xFF.
+*/
+int8_t journal_write(const uint8_t *data, uint8_t len)
+{
+	if (journal_busy())
+		return -1;
+
+	seq++;
+	newest = (newest + 1) % JRN_SLOTS;
+	found = TRUE;
+
+	wr_buf[0] = seq & 0xFF;
+	wr_buf[1] = seq >> 8;
+	for (uint8_t i = 0; i < JRN_DATA_LEN; i++)
+		wr_buf[2 + i] = (i < len) ? data[i] : 0xFF;
+	wr_buf[JRN_REC_LEN - 1] = journal_crc(wr_buf);
+	wr_addr = JRN_BASE + (newest * JRN_REC_LEN);
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		wr_idx = 0;
+		hal_eeprom_irq(ON);
+	}
+
+	return 0;
+}
+
+/*===========================================================================*/
+uint8_t journal_busy(void)
+{
+	return (wr_idx < JRN_REC_LEN);
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* CRC of a record's sequence number and payload.
+*/
+static uint8_t journal_crc(const uint8_t *rec)
+{
+	uint8_t crc = JRN_CRC_INIT;
+
+	for (uint8_t i = 0; i < JRN_REC_LEN - 1; i++)
+		crc = crc8_update(crc, rec[i]);
+	return crc;
+}
+
+/******************************************************************************
+********************* I N T E R R U P T   H A N D L E R S *********************
+******************************************************************************/
+
+/*===========================================================================*/
+/*
+* EEPROM ready: start the next byte of the record, or stop the interrupt
+* once the last one (the CRC) is done.
+*/
+HAL_ISR (EE_READY_vect)
+{
+	if (wr_idx >= JRN_REC_LEN) {
+		hal_eeprom_irq(OFF);
+		return;
+	}
+	hal_eeprom_write(wr_addr + wr_idx, wr_buf[wr_idx]);
+	wr_idx++;
+}
@@ -0,0 +1,25 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define JRN_DATA_LEN		5		// payload bytes per record
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void journal_init(void);
+uint8_t journal_read(uint8_t *data, uint8_t len);
+int8_t journal_write(const uint8_t *data, uint8_t len);
+uint8_t journal_busy(void);
+
+#endif	/* JOURNAL_H */
@@ -5,17 +5,27 @@
 
 #include "config.h"
 #include "adc.h"
+#include "anim.h"
+#include "bench.h"
+#include "button.h"
+#include "console.h"
+#include "i2c.h"
 #include "init.h"
 #include "rtc.h"
+#include "sched.h"
+#include "settings.h"
 #include "timers.h"
+#include "prof.h"
+#include "trace.h"
 #include "util.h"
 
-#include <avr/interrupt.h>
+#include "hal.h"
 
 /******************************************************************************
 ********************* F U S E S   D E F I N I T I O N S ***********************
 ******************************************************************************/
 
+#ifndef HAL_HOST
 /*
 * These fuse settings will be placed in a special section in the ELF output 
 * file, after linking. Programming tools can take advantage of the fuse info
@@ -36,6 +46,7 @@ FUSES = {
 };
 //Place lockbits in a special section (.lock) in the .ELF output file
 LOCKBITS = LOCK_BITS;
+#endif
 
 /******************************************************************************
 ******************* C O N S T A N T   D E F I N I T I O N S *******************
@@ -44,113 +55,161 @@ LOCKBITS = LOCK_BITS;
 #define MODE_0 		0x00
 #define MODE_1 		0x01
 
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static uint8_t display_mode = MODE_0;
+static uint8_t redraw = TRUE;			// flag; time changed, compose display
+
+/******************************************************************************
+*********************** T A S K   D E F I N I T I O N S ***********************
+******************************************************************************/
+
+static void task_buttons(void);
+static void task_clock(void);
+static void task_display(void);
+static void task_anim(void);
+
+/*
+* Scheduler table: function, period (ms), phase (ms). Phases spread the
+* slower tasks over different ticks.
+*/
+static const task_s tasks[] PROGMEM = {
+	{ i2c_service,	1,				1 },
+	{ task_buttons,	1,				1 },
+	{ task_clock,	10,				3 },
+	{ task_display,	5,				2 },
+	{ task_anim,	ANIM_DIGIT_MS,	7 },
+	{ console_service,	CONSOLE_POLL_MS,	2 },
+};
+
 /******************************************************************************
 *************************** M A I N   P R O G R A M ***************************
 ******************************************************************************/
 
 int main(void)
 {
+	time_s now;
+	uint8_t mode_12h;
+
 	boot();
-	
-	uint8_t display_mode = MODE_0;
-	uint8_t key;
-
-	volatile uint8_t *loop = timer_get_loop_flag();
-	volatile display_s *display = timer_get_display_handler();
-	volatile time_s *time = rtc_get_time_handler();
-	volatile btn_s *btn1 = adc_get_button_handler(1);
-	volatile btn_s *btn2 = adc_get_button_handler(2);
-	volatile btn_s *btn3 = adc_get_button_handler(3);
-	volatile btn_s *btn4 = adc_get_button_handler(4);
-	
-	// change hour mode (12h/24h)
-	// if any key is pressed at startup, change hour mode.
-	if (adc_key_press() < 5)
-		rtc_change_hour_mode();
-	// Wait 'til key is released
-	while(adc_key_press() != 5);
 
 	// First clock read
 	rtc_read_time();
+	rtc_get_time(&now);
 
-	// Main Infinite Loop
-	while(TRUE) {
+	// hour mode (12h/24h) from the settings; the RTC's own until one is
+	// stored. If any key is pressed at startup, change hour mode.
+	mode_12h = settings_get(SET_HOUR_12H);
+	if (mode_12h == SET_UNSET)
+		mode_12h = ((now.hour & TIME_12H) != 0);
+	if (adc_key_press() < 5)
+		mode_12h = !mode_12h;
+	settings_set(SET_HOUR_12H, mode_12h);
+	if (mode_12h != ((now.hour & TIME_12H) != 0))
+		rtc_set_hour_mode(mode_12h);
+	// Wait 'til key is released
+	while(adc_key_press() != 5);
 
-		switch (display_mode) {
+	// Main Infinite Loop: tasks run from the scheduler, the CPU sleeps
+	// between them
+	sched_init(tasks, sizeof(tasks) / sizeof(tasks[0]));
+	sched_run();
+}
 
-			case MODE_0:
-				display->d1 = time->h_tens;
-				display->d2 = time->h_units;	
-				display->d3 = time->m_tens;
-				display->d4 = time->m_units;
-				break;
-			
-			case MODE_1:
-				// some other states or animations
-				break;
+/*-----------------------------------------------------------------------------
+--------------------------------- T A S K S -----------------------------------
+-----------------------------------------------------------------------------*/
 
-			default:
+/*===========================================================================*/
+/*
+* Read buttons, then act on their events: short press or hold (repeating)
+* steps minutes / hours.
+*/
+static void task_buttons(void)
+{
+	uint8_t ev;
+
+	button_scan(adc_key_press());
+	while ((ev = button_get_event()) != BTN_NONE) {
+		switch (BTN_EV_TYPE(ev)) {
+			case BTN_SHORT_RELEASE:
+			case BTN_HOLD:
+			case BTN_REPEAT:
 				break;
+			default:
+				continue;
 		}
-
-		// Continuously read buttons:
-		key = adc_key_press();
-		key_check(key, btn1);
-		key_check(key, btn2);
-		key_check(key, btn3);
-		key_check(key, btn4);
-		/*-----------------------------------*/
-		// button 1 press and hold
-		if((btn1->action) && (btn1->state == BTN_PUSHED) && (btn1->delay2)){
-			btn1->delay2 = FALSE;
-			rtc_change_minutes(DOWN);
-		}
-		// button 1 short press
-		if((btn1->action) && (btn1->state == BTN_RELEASED) && (!btn1->delay1)){
-			btn1->action = FALSE;
-			rtc_change_minutes(DOWN);
-		}
-		/*-----------------------------------*/
-		// button 2 press and hold
-		if((btn2->action) && (btn2->state == BTN_PUSHED) && (btn2->delay2)){
-			btn2->delay2 = FALSE;
-			rtc_change_minutes(UP);
-		}
-		// button 2 short press
-		if((btn2->action) && (btn2->state == BTN_RELEASED) && (!btn2->delay1)){
-			btn2->action = FALSE;
-			rtc_change_minutes(UP);
-		}
-		/*-----------------------------------*/
-		// button 3 press and hold
-		if((btn3->action) && (btn3->state == BTN_PUSHED) && (btn3->delay2)){
-			btn3->delay2 = FALSE;
-			rtc_change_hours(DOWN);
-		}
-		// button 3 short press
-		if((btn3->action) && (btn3->state == BTN_RELEASED) && (!btn3->delay1)){
-			btn3->action = FALSE;
-			rtc_change_hours(DOWN);
-		}
-		/*-----------------------------------*/
-		// button 4 press and hold
-		if((btn4->action) && (btn4->state == BTN_PUSHED) && (btn4->delay2)){
-			btn4->delay2 = FALSE;
-			rtc_change_hours(UP);
-		}
-		// button 4 short press
-		if((btn4->action) && (btn4->state == BTN_RELEASED) && (!btn4->delay1)){
-			btn4->action = FALSE;
-			rtc_change_hours(UP);
+		switch (BTN_EV_KEY(ev)) {
+			case 1: rtc_change_minutes(DOWN); break;
+			case 2: rtc_change_minutes(UP); break;
+			case 3: rtc_change_hours(DOWN); break;
+			case 4: rtc_change_hours(UP); break;
+			default: break;
 		}
-		
-		/*
-		* Loop timing syncronization
-		* ISRs are only enabled when the CPU is waiting for the next loop execution
-		*/
-		sei();
-		while(!(*loop));
-		*loop = FALSE;
-		cli();
 	}
-}
\ No newline at end of file
+}
+
+/*===========================================================================*/
+/*
+* 1Hz software clock tick, posted by the SQW / Timer 1 ISRs. The digits that
+* changed (tick, edits, RTC reads) decide what needs doing: a redraw only
+* when HH:MM changed, the cathode exercise check only on a new minute.
+*/
+static void task_clock(void)
+{
+	uint8_t changes;
+
+	if (rtc_take_update()) {
+		rtc_tick();
+		settings_tick();
+		TRACE_TICK();
+		PROF_TICK();
+	}
+
+	changes = rtc_take_changes();
+	if (changes & TIME_CH_HHMM)
+		redraw = TRUE;
+	if ((changes & TIME_CH_M_UNITS) && anim_cathode_due()) {
+		anim_cathode_start();
+		display_mode = MODE_1;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Shows the time, only when it has changed.
+*/
+static void task_display(void)
+{
+	time_s now;
+	display_s d;
+
+	if ((display_mode != MODE_0) || (!redraw))
+		return;
+
+	redraw = FALSE;
+	rtc_get_time(&now);
+	d.mode = ON;
+	d.d1 = BCD_TENS(TIME_HOUR_BCD(now));
+	d.d2 = BCD_UNITS(TIME_HOUR_BCD(now));
+	d.d3 = BCD_TENS(now.min);
+	d.d4 = BCD_UNITS(now.min);
+	timer_display_set(&d);
+}
+
+/*===========================================================================*/
+/*
+* Cathode exercise, one digit per run. Back to the time once it's over.
+*/
+static void task_anim(void)
+{
+	if (display_mode != MODE_1)
+		return;
+
+	if (!anim_cathode_run()) {
+		display_mode = MODE_0;
+		redraw = TRUE;
+	}
+}
@@ -0,0 +1,229 @@
+/**
+ * @file prof.c
+ * @brief Statistical PC-sampling profiler, dumped over the UART
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "prof.h"
+#include "config.h"
+#include "uart.h"
+#include "util.h"
+
+#include "hal.h"
+
+#if defined(PROF) && !defined(HAL_HOST)
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* Sampling clock, Timer 2 in CTC mode: 16MHz/1024/17 = 919Hz. Not a divisor
+* of the 1ms scheduler tick, so the samples drift across the tick instead of
+* always hitting the same point of the main loop.
+*/
+#define PROF_OCR			16
+
+#ifndef PROF_DUMP_S
+#define PROF_DUMP_S			10		// seconds between dumps
+#endif
+
+/*
+* Dump frame: 'P' 'F', bucket shift, bucket count (LE), counts (LE), samples
+* above the last bucket (LE), CRC-8 of everything after 'P' 'F'.
+*/
+#define FRAME_HEAD			5
+#define FRAME_LEN			(FRAME_HEAD + (2 * PROF_BUCKETS) + 2 + 1)
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+// Not static: the bench runner reads them straight from the simulated SRAM
+volatile uint16_t prof_hist[PROF_BUCKETS];
+volatile uint16_t prof_overflow;
+
+static volatile uint8_t frozen;			// flag; dump in progress, don't sample
+static uint8_t seconds;
+
+// Dump state, see prof_next()
+static uint16_t tx_pos;					// byte of the frame
+static uint8_t tx_crc;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static uint8_t prof_next(uint8_t *b);
+
+/*===========================================================================*/
+void prof_init(void)
+{
+	frozen = FALSE;
+	seconds = 0;
+
+	/* TIMER COUNTER 2 */
+	TCCR2A |= (1<<WGM21);	// CTC mode, TOP: OCR2A
+	TCNT2 = 0;
+	OCR2A = PROF_OCR;
+	TIFR2 |= (1<<OCF2A);	// clear interrupt flag, if set.
+	TIMSK2 |= (1<<OCIE2A);	// Interrupts for compare match
+	TCCR2B |= (1<<CS22) | (1<<CS21) | (1<<CS20);	// /1024
+}
+
+/*===========================================================================*/
+/*
+* Counts one sample. 'pc' is the interrupted word address; counters saturate
+* instead of wrapping.
+*/
+void prof_sample(uint16_t pc)
+{
+	uint16_t bucket;
+
+	if (frozen)
+		return;
+
+	bucket = pc >> (PROF_SHIFT - 1);
+	if (bucket < PROF_BUCKETS) {
+		if (prof_hist[bucket] != 0xFFFF)
+			prof_hist[bucket]++;
+	} else if (prof_overflow != 0xFFFF) {
+		prof_overflow++;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Called once per second, dumps the histogram every PROF_DUMP_S seconds.
+*/
+void prof_tick(void)
+{
+	if (++seconds < PROF_DUMP_S)
+		return;
+	seconds = 0;
+	prof_dump();
+}
+
+/*===========================================================================*/
+/*
+* Freezes the histogram and sends it in the background (~45ms at 115200
+* baud). Sampling resumes, from zero, once the frame is out.
+*/
+void prof_dump(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (!frozen) {
+			tx_pos = 0;
+			tx_crc = 0;
+			frozen = uart_stream(prof_next);
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Stream source for uart_stream(), UDRE interrupt: next byte of the frame.
+* Clears the histogram and resumes sampling once the frame is out.
+*/
+static uint8_t prof_next(uint8_t *b)
+{
+	uint16_t i;
+
+	if (tx_pos >= FRAME_LEN) {
+		for (i = 0; i < PROF_BUCKETS; i++)
+			prof_hist[i] = 0;
+		prof_overflow = 0;
+		frozen = FALSE;
+		return FALSE;
+	}
+
+	if (tx_pos == 0) {
+		*b = 'P';
+	} else if (tx_pos == 1) {
+		*b = 'F';
+	} else if (tx_pos < FRAME_LEN - 1) {
+		if (tx_pos == 2) {
+			*b = PROF_SHIFT;
+		} else if (tx_pos == 3) {
+			*b = PROF_BUCKETS & 0xFF;
+		} else if (tx_pos == 4) {
+			*b = PROF_BUCKETS >> 8;
+		} else if (tx_pos < FRAME_LEN - 3) {
+			i = tx_pos - FRAME_HEAD;
+			*b = (i & 1) ? (prof_hist[i >> 1] >> 8) : (prof_hist[i >> 1] & 0xFF);
+		} else {
+			*b = (tx_pos == FRAME_LEN - 3) ? (prof_overflow & 0xFF) : (prof_overflow >> 8);
+		}
+		tx_crc = crc8_update(tx_crc, *b);
+	} else {
+		*b = tx_crc;
+	}
+	tx_pos++;
+	return TRUE;
+}
+
+/******************************************************************************
+********************* I N T E R R U P T   H A N D L E R S *********************
+******************************************************************************/
+
+/*===========================================================================*/
+/*
+* Sampling tick. Saves the registers prof_sample() may clobber (15 bytes),
+* then picks the return address pushed by the interrupt (high byte first)
+* off the stack and passes it on in r25:r24.
+* Interrupts don't nest, so time spent in other ISRs or with the I flag
+* clear is charged to the first instruction that runs after it.
+*/
+HAL_ISR_NAKED (TIMER2_COMPA_vect)
+{
+	__asm__ __volatile__ (
+		"push r0"				"\n\t"
+		"in r0, __SREG__"		"\n\t"
+		"push r0"				"\n\t"
+		"push r1"				"\n\t"
+		"clr r1"				"\n\t"
+		"push r18"				"\n\t"
+		"push r19"				"\n\t"
+		"push r20"				"\n\t"
+		"push r21"				"\n\t"
+		"push r22"				"\n\t"
+		"push r23"				"\n\t"
+		"push r24"				"\n\t"
+		"push r25"				"\n\t"
+		"push r26"				"\n\t"
+		"push r27"				"\n\t"
+		"push r30"				"\n\t"
+		"push r31"				"\n\t"
+		"in r30, __SP_L__"		"\n\t"
+		"in r31, __SP_H__"		"\n\t"
+		"ldd r25, Z+16"			"\n\t"	// SP+1..15: saved registers
+		"ldd r24, Z+17"			"\n\t"
+		"call prof_sample"		"\n\t"
+		"pop r31"				"\n\t"
+		"pop r30"				"\n\t"
+		"pop r27"				"\n\t"
+		"pop r26"				"\n\t"
+		"pop r25"				"\n\t"
+		"pop r24"				"\n\t"
+		"pop r23"				"\n\t"
+		"pop r22"				"\n\t"
+		"pop r21"				"\n\t"
+		"pop r20"				"\n\t"
+		"pop r19"				"\n\t"
+		"pop r18"				"\n\t"
+		"pop r1"				"\n\t"
+		"pop r0"				"\n\t"
+		"out __SREG__, r0"		"\n\t"
+		"pop r0"				"\n\t"
+		"reti"					"\n\t"
+	);
+}
+
+#endif	/* PROF && !HAL_HOST */
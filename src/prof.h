@@ -0,0 +1,42 @@
+#ifndef PROF_H
+#define PROF_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* Statistical PC-sampling profiler, compiled in with -DPROF on the AVR build
+* ('make prof' runs it under simavr). A Timer 2 interrupt samples the
+* interrupted program counter into a histogram of flash address buckets,
+* sent over the UART (TXD, PD1) every PROF_DUMP_S seconds and mapped back to
+* functions by tools/prof. The host build runs natively; profile it with
+* perf instead. Without PROF the macros compile to nothing.
+*/
+#if defined(PROF) && !defined(HAL_HOST)
+#define PROF_INIT()			prof_init()
+#define PROF_TICK()			prof_tick()
+#else
+#define PROF_INIT()
+#define PROF_TICK()
+#endif
+
+#define PROF_SHIFT			6		// 64 byte buckets...
+#define PROF_BUCKETS		256		// ...covering the first 16KB of flash
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void prof_init(void);
+void prof_tick(void);
+void prof_dump(void);
+void prof_sample(uint16_t pc);		// from the sampling ISR only
+
+#endif	/* PROF_H */
@@ -0,0 +1,186 @@
+/**
+ * @file proto.c
+ * @brief Binary framed protocol on the console UART
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "proto.h"
+#include "config.h"
+#include "i2c.h"
+#include "rtc.h"
+#include "uart.h"
+#include "util.h"
+
+#include "hal.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+// Receiver states
+#define RX_IDLE				0		// waiting for PROTO_SYNC
+#define RX_LEN				1
+#define RX_PAYLOAD			2
+#define RX_CRC				3
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static uint8_t state;
+static uint8_t len;					// 0: corrupt frame, to NAK
+static uint8_t pos;
+static uint8_t crc;
+static uint8_t buf[PROTO_PAYLOAD_MAX];
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static uint8_t proto_nak(void);
+static void proto_reply(int8_t status, const uint8_t *data, uint8_t n);
+
+/*===========================================================================*/
+void proto_init(void)
+{
+	state = RX_IDLE;
+}
+
+/*===========================================================================*/
+/*
+* Parses one received byte, 'gap' ms after the one before it on the line
+* (see uart_getc()): PROTO_NONE if it isn't part of a frame (console input),
+* PROTO_BUSY if taken, PROTO_FRAME once a frame is complete; the frame is
+* then held until proto_exec(). A corrupt frame also completes, to be NAKed.
+*/
+uint8_t proto_feed(uint8_t c, uint8_t gap)
+{
+	if ((state != RX_IDLE) && (gap > PROTO_TIMEOUT_MS))
+		state = RX_IDLE;		// stalled frame
+
+	switch (state) {
+		case RX_IDLE:
+			if (c != PROTO_SYNC)
+				return PROTO_NONE;
+			state = RX_LEN;
+			break;
+		case RX_LEN:
+			if ((c == 0) || (c > PROTO_PAYLOAD_MAX))
+				return proto_nak();
+			len = c;
+			pos = 0;
+			crc = crc8_update(0, c);
+			state = RX_PAYLOAD;
+			break;
+		case RX_PAYLOAD:
+			buf[pos++] = c;
+			crc = crc8_update(crc, c);
+			if (pos == len)
+				state = RX_CRC;
+			break;
+		case RX_CRC:
+			if (c != crc)
+				return proto_nak();
+			state = RX_IDLE;
+			return PROTO_FRAME;
+	}
+	return PROTO_BUSY;
+}
+
+/*===========================================================================*/
+/*
+* Runs the frame completed by proto_feed() and queues the reply, up to
+* PROTO_REPLY_MAX bytes.
+*/
+void proto_exec(void)
+{
+	uint8_t data[4];
+	time_s t;
+
+	if (len == 0) {
+		proto_reply(PROTO_ERR_FRAME, NULL, 0);
+		return;
+	}
+
+	switch (buf[0]) {
+		case PROTO_PING:
+			if (len != 2)
+				break;
+			proto_reply(PROTO_OK, &buf[1], 1);
+			return;
+
+		case PROTO_GET_TIME:
+			if (len != 1)
+				break;
+			rtc_get_time(&t);
+			data[0] = rtc_hour24(&t);
+			data[1] = (BCD_TENS(t.min) * 10) + BCD_UNITS(t.min);
+			data[2] = (BCD_TENS(t.sec) * 10) + BCD_UNITS(t.sec);
+			data[3] = (t.hour & TIME_12H) != 0;
+			proto_reply(PROTO_OK, data, 4);
+			return;
+
+		case PROTO_SET_TIME:
+			// applied at once: the DS1307 restarts its second when the
+			// seconds register is written, so the sender times the frame
+			if (len != 4)
+				break;
+			rtc_get_time(&t);
+			switch (rtc_set_time(buf[1], buf[2], buf[3], (t.hour & TIME_12H) != 0)) {
+				case I2C_OK:		proto_reply(PROTO_OK, NULL, 0);			break;
+				case I2C_ERR_FULL:	proto_reply(PROTO_ERR_BUSY, NULL, 0);	break;
+				default:			proto_reply(PROTO_ERR_ARG, NULL, 0);	break;
+			}
+			return;
+
+		default:
+			break;
+	}
+	proto_reply(PROTO_ERR_CMD, NULL, 0);
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Ends a frame with a bad length or CRC as a PROTO_NAK one, so proto_exec()
+* answers it instead of it being dropped silently.
+*/
+static uint8_t proto_nak(void)
+{
+	state = RX_IDLE;
+	buf[0] = PROTO_NAK;
+	len = 0;
+	return PROTO_FRAME;
+}
+
+/*===========================================================================*/
+/*
+* Reply frame to the command in 'buf': command | PROTO_REPLY, 'status',
+* then 'n' bytes of 'data'.
+*/
+static void proto_reply(int8_t status, const uint8_t *data, uint8_t n)
+{
+	uint8_t c;
+	uint8_t sum;
+
+	uart_putc(PROTO_SYNC);
+	c = n + 2;
+	uart_putc(c);
+	sum = crc8_update(0, c);
+	c = buf[0] | PROTO_REPLY;
+	uart_putc(c);
+	sum = crc8_update(sum, c);
+	uart_putc((uint8_t)status);
+	sum = crc8_update(sum, (uint8_t)status);
+	for (uint8_t i = 0; i < n; i++) {
+		uart_putc(data[i]);
+		sum = crc8_update(sum, data[i]);
+	}
+	uart_putc(sum);
+}
@@ -0,0 +1,60 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* Binary frames on the console UART, for tools (tools/timesync):
+*	PROTO_SYNC  len  payload[len]  CRC-8 of len and payload
+* The sync byte is not ASCII, so frames and console lines can be mixed.
+* payload[0] is the command; the reply has the command | PROTO_REPLY, a
+* status byte (PROTO_OK or a negative code) and the command's data.
+*	PROTO_PING		[tag]			-> [tag]
+*	PROTO_GET_TIME	[]				-> [hour (0-23), min, sec, 12h mode]
+*	PROTO_SET_TIME	[hour, min, sec] -> []
+* All values binary. A frame with a bad length or CRC is answered with
+* PROTO_NAK | PROTO_REPLY and PROTO_ERR_FRAME, so the sender can tell a
+* corrupt frame from a lost one. A frame interrupted by more than
+* PROTO_TIMEOUT_MS of silence on the line is dropped.
+*/
+#define PROTO_SYNC			0xA5
+#define PROTO_PAYLOAD_MAX	8
+#define PROTO_TIMEOUT_MS	20
+#define PROTO_REPLY_MAX		9		// sync, len, command, status, 4 data, CRC
+
+// Commands
+#define PROTO_PING			0x01
+#define PROTO_GET_TIME		0x02
+#define PROTO_SET_TIME		0x03
+#define PROTO_NAK			0x7F	// reply only, to a corrupt frame
+#define PROTO_REPLY			0x80
+
+// Reply status
+#define PROTO_OK			0
+#define PROTO_ERR_CMD		-1		// unknown command or bad length
+#define PROTO_ERR_ARG		-2		// value out of range
+#define PROTO_ERR_BUSY		-3		// previous RTC write still pending
+#define PROTO_ERR_FRAME		-4		// bad length or CRC, see PROTO_NAK
+
+// proto_feed() results
+#define PROTO_NONE			0		// not a frame byte, for the console
+#define PROTO_BUSY			1		// taken, frame not complete
+#define PROTO_FRAME			2		// frame complete (or corrupt), see proto_exec()
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void proto_init(void);
+uint8_t proto_feed(uint8_t c, uint8_t gap);
+void proto_exec(void);
+
+#endif	/* PROTO_H */
@@ -8,27 +8,61 @@
 #include "config.h"
 #include "timers.h"
 
-#include <avr/io.h>
+#include "hal.h"
 
 /******************************************************************************
 *************** G L O B A L   V A R S   D E F I N I T I O N S *****************
 ******************************************************************************/
 
-volatile time_s 	time;
+/*
+* 'time' and 'date' are written and read from the main context only (the
+* ISRs just post 'update'), so rtc_get_time() / rtc_get_date() are plain
+* copies. Writes go between rtc_write_begin() and rtc_write_end(), which
+* record the digits they changed.
+*/
+static time_s 			time;
+static date_s			date;
+static time_s			prev;			// 'time' before the write in progress
+static uint8_t			changed;		// TIME_CH_* bits, see rtc_take_changes()
+static volatile uint8_t	update;			// flag; 1Hz tick posted by the ISRs
+
+static uint16_t		since_sync;			// ticks since the last RTC read
+static uint8_t		resync;				// flag; read the RTC on the next tick
+static uint8_t		syncing;			// flag; resync read queued, not applied yet
+static int16_t		drift;				// last correction applied: RTC - local (s)
+
+static uint8_t		rtc_reg_addr;		// register pointer to read from
+static uint8_t		rtc_buf[7];			// burst read: seconds ... years
+static i2c_txn_s	rtc_txn;
+
+/*
+* Raw date registers 'date' was last decoded from: only the date fields
+* whose byte differs are decoded again. The time fields are kept in the
+* register format, so they are just copied.
+*/
+static uint8_t		rtc_img[7];
+static uint8_t		stale;				// bit n: field n never decoded
+
+/*
+* Edit session: button edits only change 'time' in RAM. Once no edit has
+* come in for RTC_EDIT_IDLE seconds, seconds (reset to 0), minutes and
+* hours go to the DS1307 in a single burst write.
+*/
+static uint8_t		editing;			// flag; RAM time ahead of the RTC
+static uint8_t		edit_idle;			// ticks since the last edit
+static uint8_t		rtc_wr_buf[4];		// register pointer + sec, min, hour
+static i2c_txn_s	rtc_wr_txn;
+
+// Battery backed RAM writes: register pointer + data, copied at queue time
+static uint8_t		rtc_ram_buf[1 + RTC_RAM_WR_MAX];
+static i2c_txn_s	rtc_ram_txn;
 
 /******************************************************************************
 ******************* C O N S T A N T   D E F I N I T I O N S *******************
 ******************************************************************************/
 
-// TIME handler
-#define MODE_12H		0x12
-#define MODE_24H		0x24
-#define PERIOD_AM		0xAA
-#define PERIOD_PM		0xFF
-
 // RTC
 #define RTC_SLAVE_ID_W		0b11010000			// DS1307 address + w
-#define RTC_SLAVE_ID_R		0b11010001			// DS1307 address + r
 
 #define RTC_SECONDS_REG 	0x00
 #define RTC_MINUTES_REG 	0x01
@@ -41,225 +75,421 @@ volatile time_s 	time;
 #define RTC_RAM_BEGIN 		0x08
 #define RTC_RAM_END 		0x3F
 
+#define RTC_TIME_REGS		7					// seconds ... years
+#define RTC_ALL_FIELDS		0x7F
+
+// Software clock: seconds between RTC reads
+#ifndef RTC_RESYNC_TIME
+#define RTC_RESYNC_TIME		600
+#endif
+#ifndef RTC_EDIT_IDLE
+#define RTC_EDIT_IDLE		2		// seconds without edits -> commit
+#endif
+
+// Register value bits, and BCD tens digit x10 for the date decode
+static const uint8_t rtc_reg_mask[RTC_TIME_REGS] PROGMEM = {
+	0x7F,	// seconds, without CH
+	0x7F,	// minutes
+	0x7F,	// hours, with the 12h and PM flags
+	0x07,	// day of the week
+	0x3F,	// day of the month
+	0x1F,	// month
+	0xFF	// year
+};
+static const uint8_t bcd_tens[16] PROGMEM = {
+	0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150
+};
+
 /******************************************************************************
 ******************* F U N C T I O N   D E F I N I T I O N S *******************
 ******************************************************************************/
 
 static void rtc_halt(uint8_t flag);
+static int8_t rtc_reg_read(uint8_t reg, uint8_t *val);
+static int8_t rtc_reg_write(uint8_t reg, uint8_t val);
+static void rtc_decode_time(i2c_txn_s *txn);
+static void rtc_sync_done(i2c_txn_s *txn);
+static void rtc_hour_step(uint8_t up);
+static int32_t rtc_day_seconds(void);
+static uint8_t rtc_bcd(uint8_t reg);
+static uint8_t rtc_bcd_inc(uint8_t reg);
+static uint8_t rtc_hour_encode(uint8_t h24, uint8_t mode_12h);
+static int8_t rtc_write_regs(const time_s *t);
+static void rtc_write_begin(void);
+static void rtc_edit_touch(void);
+static void rtc_write_end(void);
 
 /*===========================================================================*/
 void rtc_init(void)
 {	
 	// RTC_CONTROL_REG:
-	// 	- Clear all
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_CONTROL_REG);
-	i2c_master_write(_BV(4));
-		
+	// 	- Clear all, SQWE: 1Hz square wave on SQW/OUT (time tick, see timers.c)
+	rtc_reg_write(RTC_CONTROL_REG, _BV(4));
+
 	// RTC_SECONDS_REG:
 	//	- Clear CH bit -> starts clock
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_SECONDS_REG);
-	i2c_master_start(RTC_SLAVE_ID_R);
-	uint8_t reg = i2c_master_read(LAST_BYTE);
-	reg &= ~_BV(7);
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_SECONDS_REG);
-	i2c_master_write(reg);
-	
-	i2c_stop();
-
-	// TIME handler init
-	time.sec = 0;
-	time.min = 0;
-	time.hour = 12;
-	time.s_units = 0;
-	time.s_tens = 0;
-	time.m_units = 0;
-	time.m_tens = 0;
-	time.h_units = 0;
-	time.h_tens = 0;
-	time.update = FALSE;
-	time.hour_mode = MODE_12H;
-	time.day_period = PERIOD_AM;
+	rtc_halt(FALSE);
+
+	// Time registers read transaction
+	rtc_reg_addr = RTC_SECONDS_REG;
+	rtc_txn.addr = RTC_SLAVE_ID_W;
+	rtc_txn.wr_buf = &rtc_reg_addr;
+	rtc_txn.wr_len = 1;
+	rtc_txn.rd_buf = rtc_buf;
+	rtc_txn.rd_len = RTC_TIME_REGS;
+	rtc_txn.status = I2C_IDLE;
+	rtc_txn.callback = NULL;
+
+	// TIME handler init: 12:00:00 AM
+	time.sec = 0x00;
+	time.min = 0x00;
+	time.hour = TIME_12H | 0x12;
+	changed = 0;
+	date.wday = 1;
+	date.day = 1;
+	date.month = 1;
+	date.year = 0;
+	stale = RTC_ALL_FIELDS;
+
+	update = FALSE;
+	since_sync = 0;
+	resync = FALSE;
+	syncing = FALSE;
+	drift = 0;
+
+	// Edit session commit transaction
+	rtc_wr_txn.addr = RTC_SLAVE_ID_W;
+	rtc_wr_txn.wr_buf = rtc_wr_buf;
+	rtc_wr_txn.wr_len = 4;
+	rtc_wr_txn.rd_buf = NULL;
+	rtc_wr_txn.rd_len = 0;
+	rtc_wr_txn.status = I2C_IDLE;
+	rtc_wr_txn.callback = NULL;
+	editing = FALSE;
+	edit_idle = 0;
+
+	// NVRAM write transaction
+	rtc_ram_txn.addr = RTC_SLAVE_ID_W;
+	rtc_ram_txn.wr_buf = rtc_ram_buf;
+	rtc_ram_txn.rd_buf = NULL;
+	rtc_ram_txn.rd_len = 0;
+	rtc_ram_txn.status = I2C_IDLE;
+	rtc_ram_txn.callback = NULL;
 }
 
 /*===========================================================================*/
+/*
+* Blocking read of the time registers. Only used where the result is needed
+* right away (boot); the 1Hz update uses rtc_sync_time().
+*/
 void rtc_read_time(void)
 {
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_SECONDS_REG);
-	i2c_master_start(RTC_SLAVE_ID_R);
-	uint8_t s_reg = i2c_master_read(NOT_LAST_BYTE);
-	uint8_t m_reg = i2c_master_read(NOT_LAST_BYTE);
-	uint8_t h_reg = i2c_master_read(LAST_BYTE);
-	i2c_stop();
-
-	// seconds register
-	s_reg &= ~_BV(7);
-	time.s_tens 	= s_reg >> 4;
-	time.s_units 	= s_reg & 0x0F;
-	time.sec 		= ((time.s_tens) * 10) + (time.s_units);
-	// minutes register
-	time.m_tens 	= m_reg >> 4;
-	time.m_units 	= m_reg & 0x0F;
-	time.min 		= ((time.m_tens) * 10) + (time.m_units);
-	// hours register
-	if (h_reg & _BV(6)) {
-		// 12h mode
-		time.hour_mode = MODE_12H;
-		if (h_reg & _BV(5)) time.day_period = PERIOD_PM;
-		else time. day_period = PERIOD_AM;
-		time.h_tens 	= (h_reg >> 4) & 0x01;
-		time.h_units 	= h_reg & 0x0F;
-		time.hour 		= ((time.h_tens) * 10) + (time.h_units);
-	} else {
-		time.hour_mode = MODE_24H;
-		// 24h mode
-		time.h_tens 	= (h_reg >> 4) & 0x03;
-		time.h_units 	= h_reg & 0x0F;
-		time.hour 		= ((time.h_tens) * 10) + (time.h_units);
-		if (time.hour >= 12) time.day_period = PERIOD_PM;
-		else time.day_period = PERIOD_AM;
+	while (rtc_txn.status == I2C_PENDING)	// resync read still on the bus
+		i2c_service();
+	syncing = FALSE;
+	rtc_txn.callback = NULL;
+	if (i2c_transfer(&rtc_txn) == 0) {
+		rtc_decode_time(&rtc_txn);
+		since_sync = 0;
 	}
 }
 
 /*===========================================================================*/
-void rtc_change_minutes(uint8_t up)
+/*
+* Non-blocking read of the time registers. The transaction is queued on the
+* TWI engine and the result is applied to 'time' by the next rtc_tick(), so
+* 'time' is never written from interrupt context.
+*/
+void rtc_sync_time(void)
+{
+	if (rtc_txn.status == I2C_PENDING)
+		return;
+	rtc_txn.callback = NULL;
+	if (i2c_queue(&rtc_txn) == 0)
+		syncing = TRUE;
+}
+
+/*===========================================================================*/
+/*
+* Software clock, called on every 1Hz tick. The time is advanced locally and
+* the DS1307 is only read every RTC_RESYNC_TIME seconds or after an edit.
+*/
+void rtc_tick(void)
 {
-	uint8_t m_reg;
+	// resync read queued on the last tick: RTC time as of that tick
+	if ((syncing) && (rtc_txn.status != I2C_PENDING)) {
+		syncing = FALSE;
+		rtc_sync_done(&rtc_txn);
+	}
 
-	rtc_halt(TRUE);
+	rtc_write_begin();
+	time.sec = rtc_bcd_inc(time.sec);
+	if (time.sec == 0x60) {
+		time.sec = 0x00;
+		time.min = rtc_bcd_inc(time.min);
+		if (time.min == 0x60) {
+			time.min = 0x00;
+			rtc_hour_step(UP);
+			// the date isn't kept locally: read it after midnight
+			if (rtc_hour24(&time) == 0)
+				resync = TRUE;
+		}
+	}
+	rtc_write_end();
+
+	// edit session: commit once the buttons have been idle for a while,
+	// and don't let a resync overwrite the edited time meanwhile
+	if (editing) {
+		if (++edit_idle >= RTC_EDIT_IDLE)
+			rtc_edit_commit();
+		return;
+	}
+
+	since_sync++;
+	if ((resync) || (since_sync >= RTC_RESYNC_TIME)) {
+		resync = FALSE;
+		rtc_sync_time();
+	}
+}
+
+/*===========================================================================*/
+/*
+* 1Hz tick, posted from the SQW / Timer 1 ISRs.
+*/
+void rtc_post_update(void)
+{
+	update = TRUE;
+}
+
+/*===========================================================================*/
+/*
+* TRUE (once) if a 1Hz tick has been posted since the last call.
+*/
+uint8_t rtc_take_update(void)
+{
+	uint8_t u;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		u = update;
+		update = FALSE;
+	}
+	return u;
+}
+
+/*===========================================================================*/
+/*
+* Correction applied by the last resynchronisation (RTC - software clock),
+* in seconds.
+*/
+int16_t rtc_get_drift(void)
+{
+	return drift;
+}
+
+/*===========================================================================*/
+/*
+* Edits only change the time in RAM (shown at once); the DS1307 is written
+* by rtc_edit_commit() when the edit session ends.
+*/
+void rtc_change_minutes(uint8_t up)
+{
+	uint8_t m = rtc_bcd(time.min);
 
 	if (up) {
-		if (time.min == 59) time.min = 0;
-		else (time.min)++;
+		if (m == 59) m = 0;
+		else m++;
 	} else {
-		if (time.min == 00) time.min = 59;
-		else (time.min)--;
+		if (m == 00) m = 59;
+		else m--;
 	}
-	time.m_tens 	= time.min / 10;
-	time.m_units 	= time.min % 10;
-	m_reg = (time.m_tens << 4) + (time.m_units);
+	rtc_write_begin();
+	time.min = ((m / 10) << 4) | (m % 10);
+	rtc_write_end();
 
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_MINUTES_REG);	
-	i2c_master_write(m_reg);
-	rtc_halt(FALSE);
-	i2c_stop();
+	rtc_edit_touch();
 }
 
 /*===========================================================================*/
 void rtc_change_hours(uint8_t up)
 {
-	uint8_t h_reg = 0;
+	rtc_write_begin();
+	rtc_hour_step(up);
+	rtc_write_end();
 
-	rtc_halt(TRUE);
+	rtc_edit_touch();
+}
 
-	if (time.hour_mode == MODE_24H) {
-		if (up) {
-			if (time.hour == 23) time.hour = 0;
-			else (time.hour)++;
-		} else {
-			if (time.hour == 00) time.hour = 23;
-			else (time.hour)--;
-		}
-		if (time.hour >= 12) time.day_period = PERIOD_PM;
-		else time.day_period = PERIOD_AM;
-	} else if (time.hour_mode == MODE_12H) {
-		if (up) {
-			if (time.hour == 12) {
-				time.hour = 1;
-			} else if (time.hour == 11) {
-				(time.hour)++;
-				if (time.day_period == PERIOD_AM) 
-					time.day_period = PERIOD_PM;
-				else
-					time.day_period = PERIOD_AM;
-			} else {
-				(time.hour)++;
-			}
-		} else {
-			if (time.hour == 1) {
-				time.hour = 12;
-			} else if (time.hour == 12) {
-				(time.hour)--;
-				if (time.day_period == PERIOD_AM) 
-					time.day_period = PERIOD_PM;
-				else
-					time.day_period = PERIOD_AM;
-			} else {
-				(time.hour)--;
-			}
-		}
-	}
+/*===========================================================================*/
+/*
+* Ends the edit session: seconds, minutes and hours are written to the
+* DS1307 in one burst (seconds restart from 0, CH cleared), then read back
+* on the next tick. Non-blocking; if the previous commit is still on the
+* bus it is retried on the next tick.
+*/
+void rtc_edit_commit(void)
+{
+	time_s t;
+
+	if (!editing)
+		return;
+	if (rtc_wr_txn.status == I2C_PENDING)
+		return;
+
+	t = time;
+	t.sec = 0x00;
+	if (rtc_write_regs(&t))
+		return;
+	editing = FALSE;
+}
 
-	time.h_tens 	= time.hour / 10;
-	time.h_units 	= time.hour % 10;
-
-	if (time.hour_mode == MODE_24H) {
-		h_reg = (time.h_tens << 4) + (time.h_units);
-		h_reg &= ~_BV(6);
-	} else if (time.hour_mode == MODE_12H) {
-		h_reg = (time.h_tens << 4) + (time.h_units);
-		h_reg |= _BV(6);
-		if (time.day_period == PERIOD_PM)
-			h_reg |= _BV(5);
-		else if (time.day_period == PERIOD_AM)
-			h_reg &= ~_BV(5);
+/*===========================================================================*/
+/*
+* Sets the time to 'h24':'min':'sec', shown in 12h mode if 'mode_12h'. RAM
+* time changes once the DS1307 burst write (CH cleared) is queued on the
+* TWI engine; an edit session in progress is dropped. I2C_OK, -1 if out of
+* range, I2C_ERR_FULL while the previous write is pending.
+*/
+int8_t rtc_set_time(uint8_t h24, uint8_t min, uint8_t sec, uint8_t mode_12h)
+{
+	time_s t;
+	int8_t err;
+
+	if ((h24 > 23) || (min > 59) || (sec > 59))
+		return -1;
+	if (rtc_wr_txn.status == I2C_PENDING)
+		return I2C_ERR_FULL;
+
+	t.sec = ((sec / 10) << 4) | (sec % 10);
+	t.min = ((min / 10) << 4) | (min % 10);
+	t.hour = rtc_hour_encode(h24, mode_12h);
+	err = rtc_write_regs(&t);
+	if (err)
+		return err;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		update = FALSE;		// a tick posted before the write would count twice
 	}
+	editing = FALSE;
+	syncing = FALSE;	// a read still in flight predates the write
+	return I2C_OK;
+}
 
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_HOURS_REG);	
-	i2c_master_write(h_reg);
-	rtc_halt(FALSE);
-	i2c_stop();
+/*===========================================================================*/
+/*
+* Rewrites the current time in 12h or 24h mode, with the same single burst
+* write as rtc_set_time() (the seconds restart from the written value).
+*/
+int8_t rtc_set_hour_mode(uint8_t mode_12h)
+{
+	time_s t = time;
+
+	return rtc_set_time(rtc_hour24(&t), rtc_bcd(t.min), rtc_bcd(t.sec),
+		mode_12h);
 }
 
 /*===========================================================================*/
-void rtc_change_hour_mode(void)
+/*
+* Hour of 't' in 0-23 form, whatever its hour mode is. Works on a snapshot
+* from rtc_get_time(), so the hour matches the minutes and seconds next to it.
+*/
+uint8_t rtc_hour24(const time_s *t)
 {
-	uint8_t h_reg = 0;
+	uint8_t reg = t->hour;
+	uint8_t h;
 
-	rtc_halt(TRUE);
-	rtc_read_time();
+	if (!(reg & TIME_12H))
+		return rtc_bcd(reg & 0x3F);
 
-	if (time.hour_mode == MODE_24H) {
-		time.hour_mode = MODE_12H;
-		if (time.hour > 12) {
-			time.hour -= 12;
-			time.h_tens = time.hour / 10;
-			time.h_units = time.hour % 10;
-			h_reg = (time.h_tens << 4) + time.h_units;
-			h_reg |= _BV(5);
-		} else {
-			h_reg = (time.h_tens << 4) + time.h_units;
-		}
-		h_reg |= _BV(6);	// change bit to 1: 12h
-	} else if (time.hour_mode == MODE_12H) {
-		time.hour_mode = MODE_24H;
-		if ((time.day_period == PERIOD_PM) && (time.hour < 12))
-			time.hour += 12;
-		else if ((time.day_period == PERIOD_AM) && (time.hour == 12))
-			time.hour = 0;
-		time.h_tens = time.hour / 10;
-		time.h_units = time.hour % 10;
-		h_reg = (time.h_tens << 4) + time.h_units;
-		h_reg &= ~_BV(6);	// change bit to 0: 24h
-	}	
-
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_HOURS_REG);
-	i2c_master_write(h_reg);
-	
-	rtc_halt(FALSE);
-	i2c_stop();
+	h = rtc_bcd(reg & 0x1F);
+	if (h == 12) h = 0;
+	if (reg & TIME_PM) h += 12;
+	return h;
+}
+
+/*===========================================================================*/
+/*
+* TIME_CH_* bits of the digits that changed since the last call (ticks,
+* edits, RTC reads), so that the display and the animations only do their
+* work when it matters. Cleared on read: one consumer, the main loop, which
+* hands them on.
+*/
+uint8_t rtc_take_changes(void)
+{
+	uint8_t c = changed;
+
+	changed = 0;
+	return c;
+}
+
+/*===========================================================================*/
+/*
+* Copy of the current time. Main context only, like the writers.
+*/
+void rtc_get_time(time_s *t)
+{
+	*t = time;
+}
+
+/*===========================================================================*/
+/*
+* Copy of the current date, as of the last RTC read.
+*/
+void rtc_get_date(date_s *d)
+{
+	*d = date;
+}
+
+/*===========================================================================*/
+/*
+* Blocking read of 'len' bytes of battery backed RAM from 'offset'
+* (0..RTC_RAM_SIZE-1), in one transaction. I2C_OK, or an I2C_ERR_* code;
+* -1 if the range is out of the RAM.
+*/
+int8_t rtc_ram_read(uint8_t offset, uint8_t *buf, uint8_t len)
+{
+	i2c_txn_s t;
+	uint8_t reg = RTC_RAM_BEGIN + offset;
+
+	if ((len == 0) || ((uint16_t)offset + len > RTC_RAM_SIZE))
+		return -1;
+
+	t.addr = RTC_SLAVE_ID_W;
+	t.wr_buf = &reg;
+	t.wr_len = 1;
+	t.rd_buf = buf;
+	t.rd_len = len;
+	t.callback = NULL;
+	return i2c_transfer(&t);
 }
 
 /*===========================================================================*/
-volatile time_s * rtc_get_time_handler(void)
+/*
+* Non-blocking write of up to RTC_RAM_WR_MAX bytes from 'offset', in one
+* burst. The data is copied, so 'buf' can be reused at once. I2C_ERR_FULL
+* while the previous write is still pending; see rtc_ram_status().
+*/
+int8_t rtc_ram_write(uint8_t offset, const uint8_t *buf, uint8_t len)
 {
-	return &time;
+	if ((len == 0) || (len > RTC_RAM_WR_MAX) ||
+		((uint16_t)offset + len > RTC_RAM_SIZE))
+		return -1;
+	if (rtc_ram_txn.status == I2C_PENDING)
+		return I2C_ERR_FULL;
+
+	rtc_ram_buf[0] = RTC_RAM_BEGIN + offset;
+	for (uint8_t i = 0; i < len; i++)
+		rtc_ram_buf[i + 1] = buf[i];
+	rtc_ram_txn.wr_len = len + 1;
+	return i2c_queue(&rtc_ram_txn);
+}
+
+/*===========================================================================*/
+/*
+* Status of the last rtc_ram_write(): I2C_PENDING, I2C_DONE, I2C_ERROR...
+*/
+uint8_t rtc_ram_status(void)
+{
+	return rtc_ram_txn.status;
 }
 
 /*-----------------------------------------------------------------------------
@@ -267,17 +497,264 @@ volatile time_s * rtc_get_time_handler(void)
 -----------------------------------------------------------------------------*/
 
 /*===========================================================================*/
+/*
+* Sets or clears the CH (clock halt) bit, keeping the seconds. Blocking.
+*/
 static void rtc_halt(uint8_t flag)
 {
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_SECONDS_REG);
-	i2c_master_start(RTC_SLAVE_ID_R);
-	uint8_t s_reg = i2c_master_read(LAST_BYTE);
+	uint8_t s_reg;
+
+	if (rtc_reg_read(RTC_SECONDS_REG, &s_reg) != I2C_OK)
+		return;		// don't write back a byte never read
 
 	if (flag) s_reg |= _BV(7);
 	else s_reg &= ~_BV(7);
 
-	i2c_master_start(RTC_SLAVE_ID_W);
-	i2c_master_write(RTC_SECONDS_REG);
-	i2c_master_start(s_reg);
-}
\ No newline at end of file
+	rtc_reg_write(RTC_SECONDS_REG, s_reg);
+}
+
+/*===========================================================================*/
+/*
+* Blocking single register read, for boot and the hour mode change.
+* I2C_OK or an I2C_ERR_* code.
+*/
+static int8_t rtc_reg_read(uint8_t reg, uint8_t *val)
+{
+	i2c_txn_s t;
+
+	t.addr = RTC_SLAVE_ID_W;
+	t.wr_buf = &reg;
+	t.wr_len = 1;
+	t.rd_buf = val;
+	t.rd_len = 1;
+	t.callback = NULL;
+	return i2c_transfer(&t);
+}
+
+/*===========================================================================*/
+/*
+* Blocking single register write. I2C_OK or an I2C_ERR_* code.
+*/
+static int8_t rtc_reg_write(uint8_t reg, uint8_t val)
+{
+	i2c_txn_s t;
+	uint8_t buf[2];
+
+	buf[0] = reg;
+	buf[1] = val;
+	t.addr = RTC_SLAVE_ID_W;
+	t.wr_buf = buf;
+	t.wr_len = 2;
+	t.rd_buf = NULL;
+	t.rd_len = 0;
+	t.callback = NULL;
+	return i2c_transfer(&t);
+}
+
+/*===========================================================================*/
+/*
+* Converts the burst read registers into 'time' and 'date'. The time fields
+* are masked copies; a date field is only decoded if its register changed
+* since the last read.
+*/
+static void rtc_decode_time(i2c_txn_s *txn)
+{
+	uint8_t reg, val;
+	uint8_t dirty = stale;
+	uint8_t date_ch = FALSE;
+
+	if (txn->status != I2C_DONE)
+		return;
+
+	rtc_write_begin();
+	for (uint8_t i = 0; i < RTC_TIME_REGS; i++) {
+		reg = txn->rd_buf[i];
+		if (i <= RTC_HOURS_REG) {
+			// time: kept in the register format
+			reg &= pgm_read_byte(&rtc_reg_mask[i]);
+			if (i == RTC_SECONDS_REG) time.sec = reg;
+			else if (i == RTC_MINUTES_REG) time.min = reg;
+			else time.hour = reg;
+			continue;
+		}
+		if ((reg == rtc_img[i]) && !(dirty & (1 << i)))
+			continue;
+		rtc_img[i] = reg;
+		reg &= pgm_read_byte(&rtc_reg_mask[i]);
+
+		val = rtc_bcd(reg);
+		switch (i) {
+			case RTC_DAYOFWK_REG:	date.wday = val;	break;
+			case RTC_DAYS_REG:		date.day = val;		break;
+			case RTC_MONTHS_REG:	date.month = val;	break;
+			case RTC_YEARS_REG:		date.year = val;	break;
+		}
+		date_ch = TRUE;
+	}
+	rtc_write_end();
+	stale = 0;
+	if (date_ch)
+		changed |= TIME_CH_DATE;
+}
+
+/*===========================================================================*/
+/*
+* Applies the periodic resync read: records how far the software clock had
+* drifted before overwriting it with the RTC time.
+*/
+static void rtc_sync_done(i2c_txn_s *txn)
+{
+	int32_t local;
+	int32_t diff;
+
+	if (txn->status != I2C_DONE)
+		return;
+
+	local = rtc_day_seconds();
+	rtc_decode_time(txn);
+	diff = rtc_day_seconds() - local;
+	// shortest way around midnight
+	if (diff > 43200) diff -= 86400;
+	else if (diff < -43200) diff += 86400;
+	drift = (int16_t)diff;
+	since_sync = 0;
+}
+
+/*===========================================================================*/
+/*
+* Moves 'time.hour' one hour up or down, handling the 12/24h wrap and the
+* AM/PM change.
+*/
+static void rtc_hour_step(uint8_t up)
+{
+	uint8_t h = rtc_hour24(&time);
+
+	if (up) {
+		if (h == 23) h = 0;
+		else h++;
+	} else {
+		if (h == 0) h = 23;
+		else h--;
+	}
+	time.hour = rtc_hour_encode(h, time.hour & TIME_12H);
+}
+
+/*===========================================================================*/
+/*
+* Seconds since midnight of the current 'time', in 24h terms.
+*/
+static int32_t rtc_day_seconds(void)
+{
+	int32_t h = rtc_hour24(&time);
+
+	return (h * 3600) + (rtc_bcd(time.min) * 60) + rtc_bcd(time.sec);
+}
+
+/*===========================================================================*/
+static void rtc_write_begin(void)
+{
+	prev = time;
+}
+
+/*===========================================================================*/
+/*
+* Also records which digits the write changed.
+*/
+static void rtc_write_end(void)
+{
+	uint8_t d;
+
+	d = prev.sec ^ time.sec;
+	if (d & 0x0F) changed |= TIME_CH_S_UNITS;
+	if (d & 0xF0) changed |= TIME_CH_S_TENS;
+	d = prev.min ^ time.min;
+	if (d & 0x0F) changed |= TIME_CH_M_UNITS;
+	if (d & 0xF0) changed |= TIME_CH_M_TENS;
+	d = TIME_HOUR_BCD(prev) ^ TIME_HOUR_BCD(time);
+	if (d & 0x0F) changed |= TIME_CH_H_UNITS;
+	if (d & 0xF0) changed |= TIME_CH_H_TENS;
+	if ((prev.hour ^ time.hour) & TIME_12H) changed |= TIME_CH_H_FLAGS;
+	else if ((time.hour & TIME_12H) && ((prev.hour ^ time.hour) & TIME_PM))
+		changed |= TIME_CH_H_FLAGS;
+}
+
+/*===========================================================================*/
+/*
+* Binary value of a packed BCD byte, from the tens/units nibbles through a
+* lookup table instead of a multiply.
+*/
+static uint8_t rtc_bcd(uint8_t reg)
+{
+	return pgm_read_byte(&bcd_tens[reg >> 4]) + (reg & 0x0F);
+}
+
+/*===========================================================================*/
+/*
+* Packed BCD increment; 0x59 goes to 0x60, the caller wraps.
+*/
+static uint8_t rtc_bcd_inc(uint8_t reg)
+{
+	reg++;
+	if ((reg & 0x0F) == 10)
+		reg += 6;		// carry into the tens
+	return reg;
+}
+
+/*===========================================================================*/
+/*
+* Starts or extends the edit session. A resync read still in flight
+* predates the edit and is dropped.
+*/
+static void rtc_edit_touch(void)
+{
+	editing = TRUE;
+	edit_idle = 0;
+	syncing = FALSE;
+}
+
+/*===========================================================================*/
+/*
+* DS1307 hours register for hour 'h24' (0-23), in 12h mode if 'mode_12h'.
+*/
+static uint8_t rtc_hour_encode(uint8_t h24, uint8_t mode_12h)
+{
+	uint8_t h = h24;
+	uint8_t flags = 0;
+
+	if (mode_12h) {
+		flags = TIME_12H;
+		if (h >= 12) {
+			flags |= TIME_PM;
+			h -= 12;
+		}
+		if (h == 0) h = 12;
+	}
+
+	return flags | ((h / 10) << 4) | (h % 10);
+}
+
+/*===========================================================================*/
+/*
+* Queues the burst write of 't' (same format as the registers) to the
+* seconds, minutes and hours registers. Once it is queued, 't' becomes the
+* RAM time and is read back on the next tick.
+*/
+static int8_t rtc_write_regs(const time_s *t)
+{
+	int8_t err;
+
+	rtc_wr_buf[0] = RTC_SECONDS_REG;
+	rtc_wr_buf[1] = t->sec;
+	rtc_wr_buf[2] = t->min;
+	rtc_wr_buf[3] = t->hour;
+	err = i2c_queue(&rtc_wr_txn);
+	if (err)
+		return err;
+
+	rtc_write_begin();
+	time = *t;
+	rtc_write_end();
+	since_sync = 0;
+	resync = TRUE;
+	return I2C_OK;
+}
@@ -8,34 +8,78 @@
 
 #include <stdint.h>
 
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+// time_s.hour flags, as in the DS1307 hours register
+#define TIME_12H			0x40	// 12h mode
+#define TIME_PM				0x20	// PM, 12h mode only
+
+// Packed BCD accessors
+#define BCD_TENS(b)			((b) >> 4)
+#define BCD_UNITS(b)		((b) & 0x0F)
+#define TIME_HOUR_BCD(t)	((t).hour & (((t).hour & TIME_12H) ? 0x1F : 0x3F))
+
+// rtc_take_changes() bits: digits changed since the last call
+#define TIME_CH_S_UNITS		0x01
+#define TIME_CH_S_TENS		0x02
+#define TIME_CH_M_UNITS		0x04
+#define TIME_CH_M_TENS		0x08
+#define TIME_CH_H_UNITS		0x10
+#define TIME_CH_H_TENS		0x20
+#define TIME_CH_H_FLAGS		0x40	// 12/24h mode or AM/PM
+#define TIME_CH_DATE		0x80
+#define TIME_CH_HHMM		0x7C	// anything on an HH:MM display
+
+// Battery backed RAM, offsets for rtc_ram_read() / rtc_ram_write()
+#define RTC_RAM_SIZE		56
+#define RTC_RAM_WR_MAX		16		// bytes per rtc_ram_write()
+
 /******************************************************************************
 ***************** S T R U C T U R E   D E C L A R A T I O N S *****************
 ******************************************************************************/
 
+/*
+* Time in the DS1307 register format: packed BCD, with the 12h and PM flags
+* in the hours byte (see TIME_HOUR_BCD()). Use rtc_hour24() for a binary
+* hour.
+*/
 typedef struct {
-	uint8_t	sec;			// seconds
-	uint8_t min;			// minutes
-	uint8_t hour;			// hours
-	uint8_t s_units;		// BCD seconds' units
-	uint8_t s_tens;			// BCD seconds' tens
-	uint8_t m_units;		// BCD minutes' units
-	uint8_t m_tens;			// BCD minutes' tens
-	uint8_t h_units;		// BCD hours' units
-	uint8_t h_tens;			// BCD hours' tens
-	uint8_t update;			// flag. 1Hz update?
-	uint8_t hour_mode;		// 12/24h 
-	uint8_t day_period;		// AM/PM
+	uint8_t	sec;			// BCD 00-59
+	uint8_t min;			// BCD 00-59
+	uint8_t hour;			// BCD 00-23 or 01-12, + TIME_12H, TIME_PM
 } time_s;
 
+typedef struct {
+	uint8_t wday;			// day of the week, 1-7
+	uint8_t day;			// day of the month, 1-31
+	uint8_t month;			// 1-12
+	uint8_t year;			// 0-99, from 2000
+} date_s;
+
 /******************************************************************************
 ******************** F U N C T I O N   P R O T O T Y P E S ********************
 ******************************************************************************/
 
 void rtc_init(void);
 void rtc_read_time(void);
+void rtc_sync_time(void);
+void rtc_tick(void);
+void rtc_post_update(void);
+uint8_t rtc_take_update(void);
+void rtc_get_time(time_s *t);
+void rtc_get_date(date_s *d);
+int16_t rtc_get_drift(void);
+uint8_t rtc_hour24(const time_s *t);
+uint8_t rtc_take_changes(void);
+int8_t rtc_ram_read(uint8_t offset, uint8_t *buf, uint8_t len);
+int8_t rtc_ram_write(uint8_t offset, const uint8_t *buf, uint8_t len);
+uint8_t rtc_ram_status(void);
 void rtc_change_minutes(uint8_t up);
 void rtc_change_hours(uint8_t up);
-void rtc_change_hour_mode(void);
-volatile time_s * rtc_get_time_handler(void);
+void rtc_edit_commit(void);
+int8_t rtc_set_time(uint8_t h24, uint8_t min, uint8_t sec, uint8_t mode_12h);
+int8_t rtc_set_hour_mode(uint8_t mode_12h);
 
 #endif	/* INIT_H */
\ No newline at end of file
@@ -0,0 +1,112 @@
+/**
+ * @file sched.c
+ * @brief Cooperative task scheduler
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "sched.h"
+#include "bench.h"
+#include "config.h"
+#include "timers.h"
+#include "trace.h"
+
+#include "hal.h"
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static const task_s *tasks;				// task table, in program memory
+static uint8_t n_tasks;
+static uint16_t count[SCHED_MAX_TASKS];	// ms until each task is due
+
+// Per task run time, read by tools/bench and the debugger
+volatile task_stats_s sched_stats[SCHED_MAX_TASKS];
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*===========================================================================*/
+/*
+* 'table' is an array of 'n' tasks in program memory. Tasks run in table
+* order within a tick, so put the ones that feed others first.
+*/
+void sched_init(const task_s *table, uint8_t n)
+{
+	if (n > SCHED_MAX_TASKS) n = SCHED_MAX_TASKS;
+	tasks = table;
+	n_tasks = n;
+
+	for (uint8_t i = 0; i < n; i++) {
+		count[i] = pgm_read_word(&table[i].phase);
+		sched_stats[i].runs = 0;
+		sched_stats[i].max = 0;
+		sched_stats[i].total = 0;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Never returns. For every elapsed 1ms tick the task counters are advanced;
+* the due tasks are run once (ticks missed while busy are not replayed) and
+* the CPU then idles in SLEEP_MODE_IDLE until the next interrupt. Tasks run
+* with interrupts enabled.
+*/
+void sched_run(void)
+{
+	uint16_t last = timer_get_ticks();
+	uint16_t start, elapsed;
+	uint8_t due;
+	void (*run)(void);
+
+	while (TRUE) {
+
+		due = 0;
+		while (last != timer_get_ticks()) {
+			last++;
+			for (uint8_t i = 0; i < n_tasks; i++) {
+				if (--count[i] == 0) {
+					count[i] = pgm_read_word(&tasks[i].period);
+					due |= (1 << i);
+				}
+			}
+		}
+
+		if (due) {
+			BENCH_BUSY();
+			TRACE_EVENT(TRC_LOOP, due);
+			for (uint8_t i = 0; i < n_tasks; i++) {
+				if (!(due & (1 << i)))
+					continue;
+				run = (void (*)(void))pgm_read_ptr(&tasks[i].run);
+				TRACE_EVENT(TRC_TASK_BEGIN, i);
+				start = timer_get_stamp();
+				run();
+				TRACE_EVENT(TRC_TASK_END, i);
+				elapsed = timer_get_stamp() - start;
+				sched_stats[i].runs++;
+				sched_stats[i].total += elapsed;
+				if (elapsed > sched_stats[i].max)
+					sched_stats[i].max = elapsed;
+			}
+			BENCH_IDLE();
+		}
+
+		// sleep unless a tick came in while the tasks ran
+		hal_irq_disable();
+		if (last == timer_get_ticks())
+			hal_sleep_idle();
+		hal_irq_enable();
+	}
+}
+
+/*===========================================================================*/
+volatile task_stats_s * sched_get_stats_handler(uint8_t task)
+{
+	if (task >= n_tasks) return NULL;
+	return &sched_stats[task];
+}
@@ -0,0 +1,41 @@
+
+#ifndef SCHED_H
+#define SCHED_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S *****************
+******************************************************************************/
+
+typedef struct {
+	void (*run)(void);		// task function
+	uint16_t period;		// ms between runs
+	uint16_t phase;			// ms before the first run, 1 to period
+} task_s;
+
+typedef struct {
+	uint16_t runs;			// number of runs (wraps)
+	uint16_t max;			// longest run, Timer 0 counts (4us)
+	uint32_t total;			// run time, Timer 0 counts (4us)
+} task_stats_s;
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define SCHED_MAX_TASKS		8
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void sched_init(const task_s *table, uint8_t n);
+void sched_run(void);
+volatile task_stats_s * sched_get_stats_handler(uint8_t task);
+
+#endif	/* SCHED_H */
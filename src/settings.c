@@ -0,0 +1,227 @@
+/**
+ * @file settings.c
+ * @brief User settings, kept in the DS1307 battery backed RAM and journaled
+ * to the EEPROM
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "settings.h"
+#include "anim.h"
+#include "config.h"
+#include "i2c.h"
+#include "journal.h"
+#include "rtc.h"
+#include "timers.h"
+#include "util.h"
+
+#include "hal.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*
+* NVRAM block, from offset 0: version, length, SETTINGS_LEN values and a
+* CRC-8 of all the bytes before it. A block with another version or length,
+* or a bad CRC, is replaced by the defaults.
+*/
+#define SETTINGS_VERSION	1
+#define SETTINGS_OFFSET		0
+#define BLOCK_VALUES		2						// first value byte
+#define BLOCK_LEN			(BLOCK_VALUES + SETTINGS_LEN + 1)
+
+/*
+* EEPROM journal record: version and values. It survives a flat RTC
+* battery; the NVRAM block, if valid, is the newer copy.
+*/
+#define JRN_VALUES			1
+#if (JRN_VALUES + SETTINGS_LEN) > JRN_DATA_LEN
+#error "settings don't fit in a journal record"
+#endif
+
+// 'dirty' bits: copies behind the RAM mirror
+#define DIRTY_NVRAM			0x01
+#define DIRTY_EEPROM		0x02
+#define DIRTY_ALL			(DIRTY_NVRAM | DIRTY_EEPROM)
+
+#ifndef SETTINGS_QUIET
+#define SETTINGS_QUIET		3		// seconds without changes -> write
+#endif
+
+/******************************************************************************
+******************* P R O G R A M   M E M O R Y   T A B L E S *****************
+******************************************************************************/
+
+static const uint8_t defaults[SETTINGS_LEN] PROGMEM = {
+	SET_UNSET,				// SET_HOUR_12H: keep the RTC's mode
+	FADE_STEP_MS,			// SET_FADE_MS
+	ANIM_CATHODE_HOUR		// SET_CATHODE_HOUR
+};
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static uint8_t block[BLOCK_LEN];	// RAM mirror of the NVRAM block
+static uint8_t dirty;				// DIRTY_* bits
+static uint8_t quiet;				// seconds since the last change
+static uint8_t flushing;			// flag; block write on the bus
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static uint8_t settings_crc(void);
+static void settings_check(void);
+static uint8_t settings_valid(uint8_t field, uint8_t value);
+
+/*===========================================================================*/
+/*
+* Reads the whole NVRAM block in one transaction. If it is missing or
+* corrupt, the newest EEPROM journal record is used instead, and failing
+* that the defaults; either is written back on the next quiet period.
+* Stored values out of range are replaced by their default. TRUE if stored
+* settings were loaded.
+*/
+uint8_t settings_init(void)
+{
+	uint8_t rec[JRN_DATA_LEN];
+	uint8_t i;
+
+	dirty = 0;
+	quiet = 0;
+	flushing = FALSE;
+	journal_init();
+
+	if ((rtc_ram_read(SETTINGS_OFFSET, block, BLOCK_LEN) == I2C_OK) &&
+		(block[0] == SETTINGS_VERSION) && (block[1] == SETTINGS_LEN) &&
+		(block[BLOCK_LEN - 1] == settings_crc())) {
+		settings_check();
+		return TRUE;
+	}
+
+	block[0] = SETTINGS_VERSION;
+	block[1] = SETTINGS_LEN;
+	dirty = DIRTY_NVRAM;
+	if (journal_read(rec, JRN_DATA_LEN) && (rec[0] == SETTINGS_VERSION)) {
+		for (i = 0; i < SETTINGS_LEN; i++)
+			block[BLOCK_VALUES + i] = rec[JRN_VALUES + i];
+		settings_check();
+		return TRUE;
+	}
+
+	for (i = 0; i < SETTINGS_LEN; i++)
+		block[BLOCK_VALUES + i] = pgm_read_byte(&defaults[i]);
+	dirty = DIRTY_ALL;
+	return FALSE;
+}
+
+/*===========================================================================*/
+uint8_t settings_get(uint8_t field)
+{
+	if (field >= SETTINGS_LEN) return SET_UNSET;
+	return block[BLOCK_VALUES + field];
+}
+
+/*===========================================================================*/
+/*
+* Only changes the RAM mirror; settings_tick() writes it back once the
+* settings have been left alone for SETTINGS_QUIET seconds, so a run of
+* button presses costs one NVRAM write.
+*/
+void settings_set(uint8_t field, uint8_t value)
+{
+	if ((field >= SETTINGS_LEN) || (block[BLOCK_VALUES + field] == value))
+		return;
+
+	block[BLOCK_VALUES + field] = value;
+	dirty = DIRTY_ALL;
+	quiet = 0;
+}
+
+/*===========================================================================*/
+/*
+* Called once per second. After the quiet period, flushes the block to the
+* NVRAM in one burst write and appends it to the EEPROM journal (written in
+* the background). A copy that couldn't be written stays dirty and is
+* tried again on the next tick.
+*/
+void settings_tick(void)
+{
+	uint8_t rec[JRN_VALUES + SETTINGS_LEN];
+	uint8_t st;
+
+	if (flushing) {
+		st = rtc_ram_status();
+		if (st == I2C_PENDING)
+			return;
+		flushing = FALSE;
+		if (st != I2C_DONE)
+			dirty |= DIRTY_NVRAM;
+	}
+
+	if ((!dirty) || (++quiet < SETTINGS_QUIET))
+		return;
+
+	if (dirty & DIRTY_NVRAM) {
+		block[BLOCK_LEN - 1] = settings_crc();
+		if (rtc_ram_write(SETTINGS_OFFSET, block, BLOCK_LEN) == I2C_OK) {
+			dirty &= ~DIRTY_NVRAM;
+			flushing = TRUE;
+		}
+	}
+
+	if (dirty & DIRTY_EEPROM) {
+		rec[0] = SETTINGS_VERSION;
+		for (uint8_t i = 0; i < SETTINGS_LEN; i++)
+			rec[JRN_VALUES + i] = block[BLOCK_VALUES + i];
+		if (journal_write(rec, sizeof(rec)) == 0)
+			dirty &= ~DIRTY_EEPROM;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+static uint8_t settings_crc(void)
+{
+	uint8_t crc = 0;
+
+	for (uint8_t i = 0; i < BLOCK_LEN - 1; i++)
+		crc = crc8_update(crc, block[i]);
+	return crc;
+}
+
+/*===========================================================================*/
+/*
+* Puts the default in place of every value out of range, e.g. written by an
+* older firmware, and has the corrected block written back.
+*/
+static void settings_check(void)
+{
+	for (uint8_t i = 0; i < SETTINGS_LEN; i++) {
+		if (!settings_valid(i, block[BLOCK_VALUES + i])) {
+			block[BLOCK_VALUES + i] = pgm_read_byte(&defaults[i]);
+			dirty = DIRTY_ALL;
+		}
+	}
+}
+
+/*===========================================================================*/
+static uint8_t settings_valid(uint8_t field, uint8_t value)
+{
+	switch (field) {
+		case SET_HOUR_12H:
+			return (value == FALSE) || (value == TRUE) || (value == SET_UNSET);
+		case SET_FADE_MS:
+			return (value <= SET_FADE_MAX);
+		case SET_CATHODE_HOUR:
+			return (value <= 23) || (value == ANIM_EVERY_HOUR);
+	}
+	return FALSE;
+}
@@ -0,0 +1,33 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+// Settings, indexes for settings_get() / settings_set()
+#define SET_HOUR_12H		0		// TRUE: 12h display
+#define SET_FADE_MS			1		// cross-fade step, see timer_fade_set()
+#define SET_CATHODE_HOUR	2		// cathode exercise hour, or ANIM_EVERY_HOUR
+#define SETTINGS_LEN		3
+
+#define SET_UNSET			0xFF	// no stored value yet
+
+#define SET_FADE_MAX		100		// SET_FADE_MS: longest fade step, ms
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+uint8_t settings_init(void);
+uint8_t settings_get(uint8_t field);
+void settings_set(uint8_t field, uint8_t value);
+void settings_tick(void);
+
+#endif	/* SETTINGS_H */
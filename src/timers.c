@@ -6,17 +6,66 @@
 #include "timers.h"
 #include "config.h"
 #include "rtc.h"
+#include "trace.h"
 #include "util.h"
 
-#include <avr/interrupt.h>
+#include "hal.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+// Timer 1 TOP values (16MHz/1024 -> 64us per count)
+#define T1_TOP_1HZ			15624	// fallback tick: 1s
+#define T1_TOP_SQW_TIMEOUT	19530	// 1.25s without a SQW edge -> fallback
+
+// 1Hz tick sources
+#define TICK_TIMER1			0x01
+#define TICK_SQW			0x02
+
+// Digit cross-fade: FADE_STEPS duty levels, FADE_STEP_MS each by default
+#define FADE_STEPS			16
+
+/******************************************************************************
+******************* P R O G R A M   M E M O R Y   T A B L E S *****************
+******************************************************************************/
+
+/*
+* Cross-fade duty table: Timer 0 count (0..OCR0A) at which the new digit
+* replaces the old one within a tube's 1ms mux slot, for every fade step.
+* Entry k gives the new digit (k+1)/17 of the slot. The last entries are
+* clamped to 20 counts; if COMPA still runs past the match, it makes the
+* switch itself.
+*/
+static const uint8_t fade_duty[FADE_STEPS] PROGMEM = {
+	235, 221, 206, 191, 176, 162, 147, 132,
+	118, 103,  88,  74,  59,  44,  29,  20
+};
 
 /******************************************************************************
 *************** G L O B A L   V A R S   D E F I N I T I O N S *****************
 ******************************************************************************/
 
-volatile display_s 	display;
+/*
+* Display frames: final PORTB/PORTD bits (anode + cathode) for every tube.
+* timer_display_set() composes the back frame and publishes it by flipping
+* 'front', a single byte store; the mux ISR only copies bytes out of the
+* front frame.
+*/
+static frame_s frame[2];
+static volatile uint8_t front = 0;
+
+static volatile uint16_t ticks = 0;		// 1ms ticks, free running
 
-volatile uint8_t loop = FALSE;
+static volatile uint8_t lat_max = 0;	// worst TIMER0_COMPA latency, in timer ticks
+static volatile uint8_t tick_src = TICK_TIMER1;
+
+// Cross-fade state, per tube, as port patterns
+static uint8_t fade_old_b[4], fade_old_d[4];	// pattern fading out
+static uint8_t fade_new_b[4], fade_new_d[4];	// pattern fading in
+static uint8_t fade_step[4];				// FADE_STEPS: fade done
+static volatile uint8_t fade_step_ms = FADE_STEP_MS;	// 0: fading disabled
+static uint8_t fade_b, fade_d;				// pattern for the COMPB switch
 
 /******************************************************************************
 ******************* F U N C T I O N   D E F I N I T I O N S *******************
@@ -35,16 +84,20 @@ void timers_init(void)
 	/* TIMER COUNTER 1 (16 bits) */
 	TCCR1B |= (1<<WGM12);	// CTC mode, TOP: OCR1A
 	TCNT1 = 0;
-	OCR1A = 15624;			// 15625 -> isr freq = 16MHz/1024/15625 = 1Hz
+	OCR1A = T1_TOP_1HZ;		// 15625 -> isr freq = 16MHz/1024/15625 = 1Hz
 	TIFR1 |= (1<<OCF1A);	// clear interrupt flag, if set.
 	TIMSK1 |= (1<<OCIE1A);	// Interrupts for compare match
 
-	// Display handler init
-	display.mode = ON;
-	display.d1 = 0;
-	display.d2 = 0;
-	display.d3 = 0;
-	display.d4 = 0;
+	// Display init: both frames showing 0000
+	display_s d = { ON, 0, 0, 0, 0 };
+	timer_display_set(&d);
+	timer_display_set(&d);
+
+	for (uint8_t i = 0; i < 4; i++) {
+		fade_old_b[i] = fade_new_b[i] = frame[front].portb[i];
+		fade_old_d[i] = fade_new_d[i] = frame[front].portd[i];
+		fade_step[i] = FADE_STEPS;
+	}
 }
 
 /*===========================================================================*/
@@ -74,15 +127,130 @@ void timer_sec_set(uint8_t state)
 }
 
 /*===========================================================================*/
-volatile display_s * timer_get_display_handler(void)
+/*
+* The DS1307 SQW/OUT pin (1Hz, open drain) on PD2/INT0 becomes the time tick,
+* so the display updates in phase with the RTC's own seconds. Timer 1 is
+* then only a watchdog: if no edge is seen for 1.25s it takes over as a 1Hz
+* tick until the square wave comes back.
+*/
+void timer_sqw_set(uint8_t state)
+{
+	if (state) {
+		EICRA = (EICRA & ~((1<<ISC01) | (1<<ISC00))) | (1<<ISC01);	// falling edge
+		EIFR = (1<<INTF0);		// clear interrupt flag, if set.
+		tick_src = TICK_SQW;
+		TCNT1 = 0;
+		OCR1A = T1_TOP_SQW_TIMEOUT;
+		EIMSK |= (1<<INT0);
+	} else {
+		EIMSK &= ~(1<<INT0);
+		tick_src = TICK_TIMER1;
+		TCNT1 = 0;
+		OCR1A = T1_TOP_1HZ;
+	}
+}
+
+/*===========================================================================*/
+/*
+* Cross-fade speed: each of the FADE_STEPS duty levels lasts 'step_ms'
+* milliseconds. 0 disables fading, digits change at once.
+*/
+void timer_fade_set(uint8_t step_ms)
+{
+	fade_step_ms = step_ms;
+}
+
+/*===========================================================================*/
+uint8_t timer_get_fade(void)
+{
+	return fade_step_ms;
+}
+
+/*===========================================================================*/
+/*
+* Composes a frame for 'd' (d1: leftmost tube, mode OFF: all blank) into the
+* back buffer and publishes it. Only to be called when the display changes.
+*/
+void timer_display_set(const display_s *d)
+{
+	frame_s *f = &frame[front ^ 1];
+	uint8_t digit[4];
+
+	digit[TUBE_D] = d->d1;
+	digit[TUBE_C] = d->d2;
+	digit[TUBE_B] = d->d3;
+	digit[TUBE_A] = d->d4;
+	for (uint8_t t = 0; t < 4; t++)
+		tube_digit_pattern(t, (d->mode) ? digit[t] : BLANK,
+			&f->portb[t], &f->portd[t]);
+
+	front ^= 1;
+}
+
+/*===========================================================================*/
+/*
+* Milliseconds since timers_init(), wrapping at 65536. Ticks taken while the
+* I flag is clear show up when the pending Timer 0 interrupt runs.
+*/
+uint16_t timer_get_ticks(void)
+{
+	uint16_t t;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t = ticks;
+	}
+	return t;
+}
+
+/*===========================================================================*/
+/*
+* Fine timestamp in Timer 0 counts (4us), wrapping every ~262ms: good for
+* measuring short intervals. A compare match still waiting for its ISR is
+* accounted for, so it stays monotonic while the I flag is clear for up to
+* one tick.
+*/
+uint16_t timer_get_stamp(void)
 {
-	return &display;
+	uint16_t t;
+	uint8_t c;
+
+	timer_get_time(&t, &c);
+	return (t * (uint16_t)(OCR0A + 1)) + c;
 }
 
 /*===========================================================================*/
-volatile uint8_t * timer_get_loop_flag(void)
+/*
+* Same as timer_get_stamp(), split into the 1ms tick count and the Timer 0
+* count within it, so it doesn't wrap for 65s.
+*/
+void timer_get_time(uint16_t *tick, uint8_t *count)
 {
-	return &loop;
+	uint16_t t;
+	uint8_t c;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		t = ticks;
+		c = TCNT0;
+		if (TIFR0 & (1<<OCF0A)) {
+			c = TCNT0;
+			t++;
+		}
+	}
+	*tick = t;
+	*count = c;
+}
+
+/*===========================================================================*/
+/*
+* Worst-case delay between the Timer 0 compare match and the entry of its ISR.
+* In CTC mode TCNT0 restarts from 0 on the match, so the value read at ISR
+* entry is the latency in timer ticks (64 CPU cycles = 4us each). A delay of
+* a whole 1ms period or more wraps and reads short. Shown by the console's
+* 'stats'; 'make bench' measures the same latency in cycles.
+*/
+uint8_t timer_get_max_latency(void)
+{
+	return lat_max;
 }
 
 /******************************************************************************
@@ -93,46 +261,121 @@ volatile uint8_t * timer_get_loop_flag(void)
 /*
 * TIMER 3 is used as a general purpose counter. Interrupts are generated every
 * 1ms and this time base is used for multiple purposes:
-* - loop flag is set in every execution
+* - the ms tick count (scheduler time base) is advanced in every execution
 * - Nixie tubes multiplexing routine is handled based on an internal counter
 * - Nixie tubes fading routine is handled based on an internal counter
+*
+* The tube's anode and cathode bits come precomposed in the front frame, so
+* a mux step is two masked port writes.
+*
+* Fading: when a tube's digit changes, its mux slot is split in two. The old
+* digit is lit from the start of the slot, and the COMPB match switches to
+* the new digit at the point given by fade_duty[]. Every 'fade_step_ms'
+* the switch point moves earlier, until the new digit fills the slot.
 */
-ISR (TIMER0_COMPA_vect)
+HAL_ISR (TIMER0_COMPA_vect)
 {
 	static uint8_t n_tube = 1;   // determines which tube to light up (1, 2, 3 or 4)
-	static uint8_t n_fade = 5;      // 4 Fading levels (1 to 4)
-	                                // 0: fully off; 5: fully on
-	static uint16_t cnt = 0;        // general purpose counter
+	static uint8_t n_fade = 0;      // ms into the current fade step
+
+	const frame_s *f = &frame[front];
+	uint8_t pb, pd;
+	uint8_t lat = TCNT0;
+	if (lat > lat_max) lat_max = lat;
 
-	// execute main loop every 1ms.
-	loop = TRUE;
+	// scheduler time base
+	ticks++;
+	TRACE_EVENT(TRC_T0_BEGIN, lat);
 
     // change tube selection
     n_tube++;
     if(n_tube >= 4) n_tube = 0;
-    // enable tube anode
-    set_tube(n_tube);
-
-    if(display.mode){
-        if(n_tube == TUBE_D) set_digit(display.d1);
-        else if(n_tube == TUBE_C) set_digit(display.d2);
-        else if(n_tube == TUBE_B) set_digit(display.d3);
-        else if(n_tube == TUBE_A) set_digit(display.d4);
+
+    pb = f->portb[n_tube];
+    pd = f->portd[n_tube];
+
+    // new digit: start fading from whatever is shown now
+    if((pb != fade_new_b[n_tube]) || (pd != fade_new_d[n_tube])){
+        fade_old_b[n_tube] = fade_new_b[n_tube];
+        fade_old_d[n_tube] = fade_new_d[n_tube];
+        fade_new_b[n_tube] = pb;
+        fade_new_d[n_tube] = pd;
+        fade_step[n_tube] = (fade_step_ms) ? 0 : FADE_STEPS;
+    }
+#ifdef BENCH_FADE
+    // worst case for the bench: every slot fades, at the earliest switch
+    fade_step[n_tube] = FADE_STEPS - 1;
+#endif
+
+    // enable tube anode and its cathode in one go
+    if(fade_step[n_tube] < FADE_STEPS){
+        set_tube_pattern(fade_old_b[n_tube], fade_old_d[n_tube]);
+        fade_b = pb;
+        fade_d = pd;
+        OCR0B = pgm_read_byte(&fade_duty[fade_step[n_tube]]);
+        TIFR0 = (1<<OCF0B);
+        TIMSK0 |= (1<<OCIE0B);
+        // match already passed (flag cleared above): switch now
+        if(TCNT0 >= OCR0B){
+            TIMSK0 &= ~(1<<OCIE0B);
+            set_tube_pattern(pb, pd);
+        }
     } else {
-        set_digit(BLANK);
+        set_tube_pattern(pb, pd);
+        TIMSK0 &= ~(1<<OCIE0B);
     }
-          
-    // general counter reset
-    cnt++;
-    if(cnt == 1000) cnt = 0;
-    // fade level counter
+
+    // fade step counter
     n_fade++;
-    if(n_fade > 5) n_fade = 1;
+    if(n_fade >= fade_step_ms){
+        n_fade = 0;
+        for(uint8_t i = 0; i < 4; i++)
+            if(fade_step[i] < FADE_STEPS) fade_step[i]++;
+    }
 	
+	TRACE_EVENT(TRC_T0_END, 0);
 }
 
 /*===========================================================================*/
-ISR (TIMER1_COMPA_vect)
+/*
+* Cross-fade switch point within the current mux slot: old digit -> new one.
+*/
+HAL_ISR (TIMER0_COMPB_vect)
 {
-	rtc_read_time();
+	set_tube_pattern(fade_b, fade_d);
+	TIMSK0 &= ~(1<<OCIE0B);
+}
+
+/*===========================================================================*/
+/*
+* Only flags the 1Hz update. The RTC is read from the main loop through the
+* non-blocking TWI engine, so the multiplexing ISR is never held off by a
+* bus transaction.
+* While the SQW tick is alive this only fires if an edge is missed, and
+* switches the tick over to Timer 1.
+*/
+HAL_ISR (TIMER1_COMPA_vect)
+{
+	if (tick_src == TICK_SQW) {
+		tick_src = TICK_TIMER1;
+		OCR1A = T1_TOP_1HZ;
+	}
+	TRACE_EVENT(TRC_T1, 0);
+	rtc_post_update();
+}
+
+/*===========================================================================*/
+/*
+* DS1307 SQW/OUT falling edge: the RTC seconds register just incremented.
+* Restarting Timer 1 keeps its fallback compare from firing.
+*/
+HAL_ISR (INT0_vect)
+{
+	TCNT1 = 0;
+	if (tick_src != TICK_SQW) {
+		tick_src = TICK_SQW;
+		OCR1A = T1_TOP_SQW_TIMEOUT;
+	}
+	TRACE_EVENT(TRC_SQW, 0);
+	rtc_post_update();
 }
\ No newline at end of file
@@ -8,6 +8,14 @@
 
 #include <stdint.h>
 
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#ifndef FADE_STEP_MS
+#define FADE_STEP_MS		20		// default cross-fade step, 16 x 20ms = 320ms
+#endif
+
 /******************************************************************************
 ***************** S T R U C T U R E   D E C L A R A T I O N S *****************
 ******************************************************************************/
@@ -20,6 +28,11 @@ typedef struct {
     uint8_t d4;
 } display_s;
 
+typedef struct {
+	uint8_t portb[4];		// per tube (TUBE_A..TUBE_D): PORTB mux bits
+	uint8_t portd[4];		// per tube: PORTD mux bits
+} frame_s;
+
 /******************************************************************************
 ******************** F U N C T I O N   P R O T O T Y P E S ********************
 ******************************************************************************/
@@ -27,7 +40,13 @@ typedef struct {
 void timers_init(void);
 void timer_ms_set(uint8_t state);
 void timer_sec_set(uint8_t state);
-volatile display_s * timer_get_display_handler(void);
-volatile uint8_t * timer_get_loop_flag(void);
+void timer_sqw_set(uint8_t state);
+void timer_fade_set(uint8_t step_ms);
+uint8_t timer_get_fade(void);
+void timer_display_set(const display_s *d);
+uint16_t timer_get_ticks(void);
+uint16_t timer_get_stamp(void);
+void timer_get_time(uint16_t *tick, uint8_t *count);
+uint8_t timer_get_max_latency(void);
 
 #endif 	/* TIMERS_H */
\ No newline at end of file
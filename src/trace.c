@@ -0,0 +1,160 @@
+/**
+ * @file trace.c
+ * @brief Event trace recorder, dumped over the UART
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "trace.h"
+#include "config.h"
+#include "timers.h"
+#include "uart.h"
+#include "util.h"
+
+#include "hal.h"
+
+#ifdef TRACE
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define TRACE_LEN			128		// records in the ring, 5 bytes each
+#ifndef TRACE_DUMP_S
+#define TRACE_DUMP_S		10		// seconds between dumps
+#endif
+
+/*
+* Dump frame: 'T' 'R', record count, records oldest first (event, arg,
+* tick LSB, tick MSB, Timer 0 count), CRC-8 of the count and the records.
+*/
+#define FRAME_HEAD			3
+#define REC_LEN				5
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static uint8_t ring[TRACE_LEN][REC_LEN];
+static uint8_t head;					// next record
+static uint8_t count;					// valid records
+static volatile uint8_t frozen;			// flag; dump in progress, don't record
+static uint8_t seconds;
+
+// Dump state, see trace_next()
+static uint16_t tx_pos;					// byte of the frame
+static uint16_t tx_len;
+static uint8_t tx_first;				// oldest record
+static uint8_t tx_crc;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+static uint8_t trace_next(uint8_t *b);
+
+/*===========================================================================*/
+void trace_init(void)
+{
+	head = 0;
+	count = 0;
+	frozen = FALSE;
+	seconds = 0;
+}
+
+/*===========================================================================*/
+/*
+* Appends one record, overwriting the oldest once the ring is full. Safe
+* from ISRs and the main loop.
+*/
+void trace_record(uint8_t ev, uint8_t arg)
+{
+	uint16_t t;
+	uint8_t c;
+	uint8_t *r;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (!frozen) {
+			timer_get_time(&t, &c);
+			r = ring[head];
+			r[0] = ev;
+			r[1] = arg;
+			r[2] = t & 0xFF;
+			r[3] = t >> 8;
+			r[4] = c;
+			head = (head + 1) % TRACE_LEN;
+			if (count < TRACE_LEN) count++;
+		}
+	}
+}
+
+/*===========================================================================*/
+/*
+* Called once per second, dumps the ring every TRACE_DUMP_S seconds.
+*/
+void trace_tick(void)
+{
+	if (++seconds < TRACE_DUMP_S)
+		return;
+	seconds = 0;
+	trace_dump();
+}
+
+/*===========================================================================*/
+/*
+* Freezes the ring and sends it in the background (~6ms at 115200 baud).
+* Recording resumes, from an empty ring, once the frame is out.
+*/
+void trace_dump(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (!frozen) {
+			tx_first = (head + TRACE_LEN - count) % TRACE_LEN;
+			tx_len = FRAME_HEAD + (count * REC_LEN) + 1;
+			tx_pos = 0;
+			tx_crc = 0;
+			frozen = uart_stream(trace_next);
+		}
+	}
+}
+
+/*-----------------------------------------------------------------------------
+-------------------------- L O C A L   F U N C T I O N S ----------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Stream source for uart_stream(), UDRE interrupt: next byte of the frame.
+* Unfreezes the ring, emptied, once the frame is out.
+*/
+static uint8_t trace_next(uint8_t *b)
+{
+	uint16_t i;
+
+	if (tx_pos >= tx_len) {
+		count = 0;
+		frozen = FALSE;
+		return FALSE;
+	}
+
+	if (tx_pos == 0) {
+		*b = 'T';
+	} else if (tx_pos == 1) {
+		*b = 'R';
+	} else if (tx_pos == 2) {
+		*b = count;
+		tx_crc = crc8_update(tx_crc, *b);
+	} else if (tx_pos < tx_len - 1) {
+		i = tx_pos - FRAME_HEAD;
+		*b = ring[(tx_first + (i / REC_LEN)) % TRACE_LEN][i % REC_LEN];
+		tx_crc = crc8_update(tx_crc, *b);
+	} else {
+		*b = tx_crc;
+	}
+	tx_pos++;
+	return TRUE;
+}
+
+#endif	/* TRACE */
@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+// Trace events; 'arg' in brackets
+#define TRC_T0_BEGIN		0x01	// mux ISR entry [Timer 0 latency]
+#define TRC_T0_END			0x02
+#define TRC_T1				0x03	// 1Hz fallback tick
+#define TRC_SQW				0x04	// DS1307 SQW/OUT tick
+#define TRC_I2C_BEGIN		0x05	// transaction on the bus [address]
+#define TRC_I2C_END			0x06	// transaction ended [I2C_DONE...]
+#define TRC_BTN				0x07	// button event [BTN_EVENT()]
+#define TRC_LOOP			0x08	// scheduler pass [due tasks mask]
+#define TRC_TASK_BEGIN		0x09	// [task index]
+#define TRC_TASK_END		0x0A	// [task index]
+
+/*
+* Trace recorder, compiled in with -DTRACE ('make trace'). Events go to a
+* RAM ring with a (1ms tick, Timer 0 count) timestamp; every TRACE_DUMP_S
+* seconds the ring is sent over the UART (TXD, PD1) as one frame, decoded
+* by tools/trace. Without TRACE the macros compile to nothing.
+*/
+#ifdef TRACE
+#define TRACE_INIT()		trace_init()
+#define TRACE_EVENT(ev, arg)	trace_record((ev), (arg))
+#define TRACE_TICK()		trace_tick()
+#else
+#define TRACE_INIT()
+#define TRACE_EVENT(ev, arg)
+#define TRACE_TICK()
+#endif
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void trace_init(void);
+void trace_record(uint8_t ev, uint8_t arg);
+void trace_tick(void);
+void trace_dump(void);
+
+#endif	/* TRACE_H */
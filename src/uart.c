@@ -0,0 +1,234 @@
+/**
+ * @file uart.c
+ * @brief Interrupt driven USART driver with ring buffers (RXD PD0, TXD PD1)
+ *
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include "uart.h"
+#include "config.h"
+#include "timers.h"
+
+#include "hal.h"
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define TX_MASK				(UART_TX_SIZE - 1)
+#define RX_MASK				(UART_RX_SIZE - 1)
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+/*
+* Single producer / single consumer rings: the main loop writes tx_head and
+* reads rx_tail, the interrupts own the other index. Each index is one byte,
+* so no locking is needed. One slot stays empty to tell full from empty.
+*/
+static uint8_t tx_buf[UART_TX_SIZE];
+static volatile uint8_t tx_head;
+static volatile uint8_t tx_tail;
+
+static uint8_t rx_buf[UART_RX_SIZE];
+static uint8_t rx_gap[UART_RX_SIZE];	// ms of silence before each byte, up to 255
+static volatile uint8_t rx_head;
+static volatile uint8_t rx_tail;
+static uint16_t rx_last;				// tick of the last byte received
+
+static volatile uart_source_f source;	// stream in progress, see uart_stream()
+static volatile uart_stats_s stats;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*===========================================================================*/
+void uart_init(void)
+{
+	tx_head = tx_tail = 0;
+	rx_head = rx_tail = 0;
+	source = NULL;
+	hal_uart_init(UART_UBRR);
+	hal_uart_rx_irq(ON);
+}
+
+/*===========================================================================*/
+/*
+* Next received byte into 'c'. TRUE if there was one; never waits. 'gap'
+* (if not NULL) gets the silence on the line before the byte arrived, in
+* ms up to 255, however long the byte then waited in the ring.
+*/
+uint8_t uart_getc(uint8_t *c, uint8_t *gap)
+{
+	uint8_t t = rx_tail;
+
+	if (t == rx_head)
+		return FALSE;
+	*c = rx_buf[t];
+	if (gap != NULL)
+		*gap = rx_gap[t];
+	rx_tail = (t + 1) & RX_MASK;
+	return TRUE;
+}
+
+/*===========================================================================*/
+/*
+* Queues one byte; dropped (and counted) if the ring is full, never waits.
+* Main loop only. Callers with a multi-byte reply check uart_tx_free()
+* first, so replies go out whole or not at all.
+*/
+void uart_putc(uint8_t c)
+{
+	uint8_t h = tx_head;
+	uint8_t next = (h + 1) & TX_MASK;
+
+	if (next == tx_tail) {
+		stats.tx_drops++;
+		return;
+	}
+	tx_buf[h] = c;
+	tx_head = next;
+	hal_uart_tx_irq(ON);
+}
+
+/*===========================================================================*/
+/*
+* Queues a string from program memory.
+*/
+void uart_puts_P(const char *s)
+{
+	uint8_t c;
+
+	while ((c = pgm_read_byte(s++)) != '\0')
+		uart_putc(c);
+}
+
+/*===========================================================================*/
+/*
+* Queues 'v' in decimal, without leading zeros. Digits are formatted
+* straight into the ring; no intermediate string.
+*/
+void uart_put_dec(uint16_t v)
+{
+	uint16_t div = 10000;
+	uint8_t started = FALSE;
+	uint8_t d;
+
+	while (div > 1) {
+		d = 0;
+		while (v >= div) {
+			v -= div;
+			d++;
+		}
+		if (d || started) {
+			uart_putc('0' + d);
+			started = TRUE;
+		}
+		div /= 10;
+	}
+	uart_putc('0' + v);
+}
+
+/*===========================================================================*/
+/*
+* Queues a packed BCD byte as two digits.
+*/
+void uart_put_bcd(uint8_t b)
+{
+	uart_putc('0' + (b >> 4));
+	uart_putc('0' + (b & 0x0F));
+}
+
+/*===========================================================================*/
+/*
+* Bytes that can be queued without a drop.
+*/
+uint8_t uart_tx_free(void)
+{
+	return (tx_tail - tx_head - 1) & TX_MASK;
+}
+
+/*===========================================================================*/
+/*
+* Sends a long frame straight from its owner's memory instead of the ring:
+* 'next' is called from the UDRE interrupt for each byte until it returns
+* FALSE. Queued bytes wait until the frame is out, so it is never split.
+* FALSE if another stream is in progress.
+*/
+uint8_t uart_stream(uart_source_f next)
+{
+	uint8_t ok = FALSE;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (source == NULL) {
+			source = next;
+			hal_uart_tx_irq(ON);
+			ok = TRUE;
+		}
+	}
+	return ok;
+}
+
+/*===========================================================================*/
+volatile uart_stats_s * uart_get_stats_handler(void)
+{
+	return &stats;
+}
+
+/******************************************************************************
+********************* I N T E R R U P T   H A N D L E R S *********************
+******************************************************************************/
+
+/*===========================================================================*/
+/*
+* Data register empty: next byte of the stream, else of the ring. Disabled
+* once both are empty.
+*/
+HAL_ISR (USART_UDRE_vect)
+{
+	uint8_t b;
+	uint8_t t;
+
+	if (source != NULL) {
+		if (source(&b)) {
+			hal_uart_write(b);
+			return;
+		}
+		source = NULL;
+	}
+
+	t = tx_tail;
+	if (t == tx_head) {
+		hal_uart_tx_irq(OFF);
+		return;
+	}
+	hal_uart_write(tx_buf[t]);
+	tx_tail = (t + 1) & TX_MASK;
+}
+
+/*===========================================================================*/
+/*
+* Receive complete. UDR0 is always read, to clear the interrupt. The byte is
+* stamped with the time since the previous one here, on arrival.
+*/
+HAL_ISR (USART_RX_vect)
+{
+	uint8_t c = hal_uart_read();
+	uint8_t h = rx_head;
+	uint8_t next = (h + 1) & RX_MASK;
+	uint16_t now = timer_get_ticks();
+	uint16_t gap = now - rx_last;
+
+	rx_last = now;
+	if (next == rx_tail) {
+		stats.rx_overruns++;
+		return;
+	}
+	rx_buf[h] = c;
+	rx_gap[h] = (gap > 0xFF) ? 0xFF : gap;
+	rx_head = next;
+}
@@ -0,0 +1,53 @@
+#ifndef UART_H
+#define UART_H
+
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdint.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define UART_BAUD			115200UL
+#define UART_UBRR			((F_CPU / (8 * UART_BAUD)) - 1)	// U2X0: 2.1% error
+
+// Ring sizes, powers of 2 up to 128
+#define UART_TX_SIZE		128
+#define UART_RX_SIZE		32
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S *****************
+******************************************************************************/
+
+/*
+* Diagnostic counters, never reset.
+*/
+typedef struct {
+	uint16_t rx_overruns;	// bytes received with the RX ring full, lost
+	uint16_t tx_drops;		// bytes written with the TX ring full, lost
+} uart_stats_s;
+
+/*
+* Stream source, see uart_stream(). Called from the UDRE interrupt: stores
+* the next byte in 'b' and returns TRUE, or returns FALSE once done.
+*/
+typedef uint8_t (*uart_source_f)(uint8_t *b);
+
+/******************************************************************************
+******************** F U N C T I O N   P R O T O T Y P E S ********************
+******************************************************************************/
+
+void uart_init(void);
+uint8_t uart_getc(uint8_t *c, uint8_t *gap);
+void uart_putc(uint8_t c);
+void uart_puts_P(const char *s);
+void uart_put_dec(uint16_t v);
+void uart_put_bcd(uint8_t b);
+uint8_t uart_tx_free(void);
+uint8_t uart_stream(uart_source_f next);
+volatile uart_stats_s * uart_get_stats_handler(void);
+
+#endif	/* UART_H */
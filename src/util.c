@@ -13,26 +13,63 @@
 #include "util.h"
 
 #include <stdint.h> 
-#include <avr/io.h>
+#include "hal.h"
 
 /******************************************************************************
 ******************* C O N S T A N T   D E F I N I T I O N S *******************
 ******************************************************************************/
 
-// Button time counts: These macros determine the time it takes for 
-// different flags within btnXYZ structure to be set (in milliseconds)
-#define BTN_DTCT_TIME   7		// Detect time to assume the button is pressed
-#define BTN_LOCK_TIME	30		// lock time after button released
-#define BTN_DLY1_TIME	300		// time for delay 1
-#define BTN_DLY2_TIME	65		// time for delay 2
-#define BTN_DLY3_TIME	2000	// time for delay 3
-#define BTN_BEEP_TIME	50		// duration of beep sound
+#define RND_DEFAULT_SEED	0xACE1	// any non-zero value will do
 
 /******************************************************************************
-******************* F U N C T I O N   D E F I N I T I O N S *******************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
 ******************************************************************************/
 
-static void tubes_off(void);
+static uint16_t rnd_state = RND_DEFAULT_SEED;
+
+/******************************************************************************
+******************* P R O G R A M   M E M O R Y   T A B L E S *****************
+******************************************************************************/
+
+/*
+* Cathode driver inputs (PD5, PD6, PD7, PB0) for digits 0 to 9. Entry 10 is
+* the all-ones code, which leaves the tube blank.
+*/
+static const uint8_t digit_portd[11] PROGMEM = {
+	0,											// 0
+	(1<<PORTD5),								// 1
+	0,											// 2
+	(1<<PORTD5) | (1<<PORTD6) | (1<<PORTD7),	// 3
+	(1<<PORTD6) | (1<<PORTD7),					// 4
+	(1<<PORTD5) | (1<<PORTD7),					// 5
+	(1<<PORTD7),								// 6
+	(1<<PORTD5) | (1<<PORTD6),					// 7
+	(1<<PORTD6),								// 8
+	(1<<PORTD5),								// 9
+	(1<<PORTD5) | (1<<PORTD6) | (1<<PORTD7)		// BLANK
+};
+
+static const uint8_t digit_portb[11] PROGMEM = {
+	0, (1<<PORTB0), (1<<PORTB0), 0, 0, 0, 0, 0, 0, 0, (1<<PORTB0)
+};
+
+/*
+* Anodes are active low: the selected tube's bit is cleared, the rest are set.
+*/
+static const uint8_t tube_portb[4] PROGMEM = {
+	(1<<PORTB2) | (1<<PORTB3),					// TUBE_A: PB1
+	(1<<PORTB1) | (1<<PORTB3),					// TUBE_B: PB2
+	(1<<PORTB1) | (1<<PORTB2),					// TUBE_C: PB3
+	(1<<PORTB1) | (1<<PORTB2) | (1<<PORTB3)		// TUBE_D: PD3
+};
+
+static const uint8_t tube_portd[4] PROGMEM = {
+	(1<<PORTD3), (1<<PORTD3), (1<<PORTD3), 0
+};
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
 
 /*===========================================================================*/
 /*
@@ -40,11 +77,8 @@ static void tubes_off(void);
 */
 void set_tube(uint8_t t)
 {
-	tubes_off();
-	if(t == TUBE_A) PORTB &= ~(1<<PORTB1);
-	else if (t == TUBE_B) PORTB &= ~(1<<PORTB2);
-	else if (t == TUBE_C) PORTB &= ~(1<<PORTB3);
-	else if (t == TUBE_D) PORTD &= ~(1<<PORTD3);
+	PORTB = (PORTB & ~TUBE_MASK_B) | pgm_read_byte(&tube_portb[t & 0x03]);
+	PORTD = (PORTD & ~TUBE_MASK_D) | pgm_read_byte(&tube_portd[t & 0x03]);
 }
 
 /*===========================================================================*/
@@ -53,154 +87,67 @@ void set_tube(uint8_t t)
 */
 void set_digit(uint8_t n)
 {
-	switch (n) {
-		case 0:
-			PORTD &= ~(1<<PORTD5);
-			PORTD &= ~(1<<PORTD6);
-			PORTD &= ~(1<<PORTD7);
-			PORTB &= ~(1<<PORTB0);
-			break;
-		case 9:
-			PORTD |= (1<<PORTD5);
-			PORTD &= ~(1<<PORTD6);
-			PORTD &= ~(1<<PORTD7);
-			PORTB &= ~(1<<PORTB0);
-			break;
-		case 8:
-			PORTD &= ~(1<<PORTD5);
-			PORTD |= (1<<PORTD6);
-			PORTD &= ~(1<<PORTD7);
-			PORTB &= ~(1<<PORTB0);
-			break;
-		case 7:
-			PORTD |= (1<<PORTD5);
-			PORTD |= (1<<PORTD6);
-			PORTD &= ~(1<<PORTD7);
-			PORTB &= ~(1<<PORTB0);
-			break;
-		case 6:
-			PORTD &= ~(1<<PORTD5);
-			PORTD &= ~(1<<PORTD6);
-			PORTD |= (1<<PORTD7);
-			PORTB &= ~(1<<PORTB0);
-			break;
-		case 5:
-			PORTD |= (1<<PORTD5);
-			PORTD &= ~(1<<PORTD6);
-			PORTD |= (1<<PORTD7);
-			PORTB &= ~(1<<PORTB0);
-			break;
-		case 4:
-			PORTD &= ~(1<<PORTD5);
-			PORTD |= (1<<PORTD6);
-			PORTD |= (1<<PORTD7);
-			PORTB &= ~(1<<PORTB0);
-			break;
-		case 3:
-			PORTD |= (1<<PORTD5);
-			PORTD |= (1<<PORTD6);
-			PORTD |= (1<<PORTD7);
-			PORTB &= ~(1<<PORTB0);
-			break;
-		case 2:
-			PORTD &= ~(1<<PORTD5);
-			PORTD &= ~(1<<PORTD6);
-			PORTD &= ~(1<<PORTD7);
-			PORTB |= (1<<PORTB0);
-			break;
-		case 1:
-			PORTD |= (1<<PORTD5);
-			PORTD &= ~(1<<PORTD6);
-			PORTD &= ~(1<<PORTD7);
-			PORTB |= (1<<PORTB0);
-			break;
-		default:
-			PORTD |= (1<<PORTD5);
-			PORTD |= (1<<PORTD6);
-			PORTD |= (1<<PORTD7);
-			PORTB |= (1<<PORTB0);
-			break;
-	}
+	if (n > 9) n = 10;		// BLANK
+	PORTB = (PORTB & ~DIGIT_MASK_B) | pgm_read_byte(&digit_portb[n]);
+	PORTD = (PORTD & ~DIGIT_MASK_D) | pgm_read_byte(&digit_portd[n]);
 }
 
 /*===========================================================================*/
 /*
-* Random number algorithm.
-* Based on a seed, these constant parameters selection makes the output to
-* go through all numbers 0 to 9 before they start repeating.
-* Can't remember where I took it, but it works nicely.
+* PORTB / PORTD bits that light digit 'n' on tube 't', for set_tube_pattern().
 */
-uint8_t random_number(uint8_t seed)
+void tube_digit_pattern(uint8_t t, uint8_t n, uint8_t *pb, uint8_t *pd)
 {
-	uint8_t rand;
-	rand = ((4 * seed) + 1) % 9;
-	return rand;
+	if (n > 9) n = 10;		// BLANK
+	t &= 0x03;
+	*pb = pgm_read_byte(&tube_portb[t]) | pgm_read_byte(&digit_portb[n]);
+	*pd = pgm_read_byte(&tube_portd[t]) | pgm_read_byte(&digit_portd[n]);
 }
 
 /*===========================================================================*/
-void key_check(uint8_t key, volatile btn_s *btn)
+/*
+* Seeds the random number generator. The xorshift state must never be zero,
+* so a zero seed falls back to a fixed non-zero value.
+*/
+void random_seed(uint16_t seed)
 {
-	switch(btn->state){
-
-		case BTN_IDLE:
-			if(key == btn->n) btn->count++;
-			else if(btn->count > 0) btn->count--;
-
-			if(btn->count == BTN_DTCT_TIME){
-				btn->action = TRUE;
-				btn->lock = TRUE;
-				btn->state = BTN_PUSHED;
-				btn->count = 0;
-			} else if(btn->count == 0){
-				btn->action = FALSE;
-				btn->lock = FALSE;
-				btn->query = FALSE;
-			}
-			break;
-
-		case BTN_PUSHED:
-			if(key == btn->n){
-				btn->count++;	
-			} else {
-				btn->count = 0;
-				btn->state = BTN_RELEASED;
-			}
-			if(btn->count == BTN_DLY1_TIME) btn->delay1 = TRUE;
-			if((btn->delay1) && (!(btn->count % BTN_DLY2_TIME))) btn->delay2 = TRUE;
-			if(btn->count >= BTN_DLY3_TIME) btn->delay3 = TRUE;
-			break;
-
-		case BTN_RELEASED:
-			if(key != btn->n)
-				btn->count++;
-			if(btn->count == BTN_LOCK_TIME){
-				btn->query = FALSE;
-				btn->action = FALSE;
-				btn->lock = FALSE;
-				btn->state = BTN_IDLE;
-				btn->count = 0;
-				btn->delay1 = FALSE;
-				btn->delay2 = FALSE;
-				btn->delay3 = FALSE;
-			}
-			break;
-		default:
-			break;
-	}
+	rnd_state = seed ? seed : RND_DEFAULT_SEED;
 }
 
-/*-----------------------------------------------------------------------------
---------------------- I N T E R N A L   F U N C T I O N S ---------------------
------------------------------------------------------------------------------*/
+/*===========================================================================*/
+/*
+* Random number in [0, range), range being 1 to 255.
+* 16 bit xorshift (7, 9, 8 triplet): full 2^16 - 1 period, three shifts and
+* xors per call. The high byte is used and values above the largest multiple
+* of 'range' are thrown away, so every output is equally likely.
+*/
+uint8_t random_number(uint8_t range)
+{
+	uint8_t limit, r;
+
+	if (range == 0) return 0;
+	limit = (uint8_t)(255 - (256 % range));		// last accepted value
+	do {
+		rnd_state ^= rnd_state << 7;
+		rnd_state ^= rnd_state >> 9;
+		rnd_state ^= rnd_state << 8;
+		r = rnd_state >> 8;
+	} while (r > limit);
+
+	return r % range;
+}
 
 /*===========================================================================*/
 /*
-* Disables all tubes' anodes
+* CRC-8, polynomial x^8 + x^2 + x + 1 (0x07), MSB first. Start from 0 and
+* feed one byte per call. Bitwise, to keep the flash for other things.
 */
-static void tubes_off(void)
+uint8_t crc8_update(uint8_t crc, uint8_t data)
 {
-	PORTB |= (1<<PORTB1);
-	PORTB |= (1<<PORTB2);
-	PORTB |= (1<<PORTB3);
-	PORTD |= (1<<PORTD3);
-}
\ No newline at end of file
+	crc ^= data;
+	for (uint8_t i = 0; i < 8; i++) {
+		if (crc & 0x80) crc = (crc << 1) ^ 0x07;
+		else crc <<= 1;
+	}
+	return crc;
+}
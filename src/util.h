@@ -6,16 +6,31 @@
 *******************	I N C L U D E   D E P E N D E N C I E S	*******************
 ******************************************************************************/
 
+#include <stdint.h>
 #include "config.h"
-#include "adc.h"
+
+#include "hal.h"
 
 /******************************************************************************
 ******************* C O N S T A N T   D E F I N I T I O N S *******************
 ******************************************************************************/
 
-#define BTN_IDLE		01
-#define BTN_PUSHED		02
-#define BTN_RELEASED	03
+// Port bits driven by the multiplexing routine
+#define DIGIT_MASK_D	((1<<PORTD5) | (1<<PORTD6) | (1<<PORTD7))
+#define DIGIT_MASK_B	(1<<PORTB0)
+#define TUBE_MASK_B		((1<<PORTB1) | (1<<PORTB2) | (1<<PORTB3))
+#define TUBE_MASK_D		(1<<PORTD3)
+#define MUX_MASK_B		(TUBE_MASK_B | DIGIT_MASK_B)
+#define MUX_MASK_D		(TUBE_MASK_D | DIGIT_MASK_D)
+
+/*
+* One multiplexing step: a pattern from tube_digit_pattern() holds the anode
+* and cathode bits together, a single masked write per port.
+*/
+#define set_tube_pattern(pb, pd)	do {					\
+		PORTB = (PORTB & ~MUX_MASK_B) | (pb);				\
+		PORTD = (PORTD & ~MUX_MASK_D) | (pd);				\
+	} while (0)
 
 /******************************************************************************
 ******************** F U N C T I O N   P R O T O T Y P E S ********************
@@ -23,7 +38,9 @@
 
 void set_tube(uint8_t t);
 void set_digit(uint8_t n);
-uint8_t random_number(uint8_t seed);
-void key_check(uint8_t key, volatile btn_s *btn);
+void tube_digit_pattern(uint8_t t, uint8_t n, uint8_t *pb, uint8_t *pd);
+void random_seed(uint16_t seed);
+uint8_t random_number(uint8_t range);
+uint8_t crc8_update(uint8_t crc, uint8_t data);
 
 #endif	/* UTIL_H */
\ No newline at end of file
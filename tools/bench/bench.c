@@ -0,0 +1,607 @@
+/**
+ * @file bench.c
+ * @brief Cycle-accurate firmware benchmark on simavr
+ *
+ * Runs the real firmware ELF on a simulated ATmega328 at 16MHz, with a
+ * minimal DS1307 on the TWI bus (also driving SQW/OUT on PD2) and the push
+ * button ladder at rest, and prints a JSON report:
+ *	- cycles spent in every interrupt vector (count, min, avg, max)
+ *	- worst-case latency from interrupt flag to vector entry
+ *	- cycles per call of the functions given with -f
+ *	- main loop busy time per 1ms slot (PB4 marker, firmware built -DBENCH)
+ *	- interrupts-disabled windows outside of ISRs (count, min, avg, max) and
+ *	  where the longest one started
+ *	- idle headroom
+ *	- the firmware's own per task run time statistics (sched_stats)
+ *
+ * usage: bench [-t seconds] [-f function]... main.elf
+ */
+/******************************************************************************
+*******************	I N C L U D E   D E P E N D E N C I E S	*******************
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_irq.h>
+#include <simavr/sim_regbit.h>
+#include <simavr/sim_cycle_timers.h>
+#include <simavr/avr_ioport.h>
+#include <simavr/avr_adc.h>
+#include <simavr/avr_twi.h>
+
+/******************************************************************************
+******************* C O N S T A N T   D E F I N I T I O N S *******************
+******************************************************************************/
+
+#define MCU_NAME		"atmega328"
+#define MCU_FREQ		16000000UL
+#define CYCLES_PER_MS	(MCU_FREQ / 1000)
+
+#define N_VECTORS		26
+#define MAX_FUNCS		16
+#define MAX_NEST		8
+
+#define OPCODE_RETI		0x9518
+
+#define DS1307_ADDR		0xD0
+
+#define SRAM_OFFSET		0x800000	// data addresses as printed by avr-nm
+#define TASK_STATS_SIZE	8			// sizeof(task_stats_s) in sched.h
+#define US_PER_T0_COUNT	4			// Timer 0 at 16MHz/64
+#define PROF_SHIFT		6			// src/prof.h
+#define PROF_BUCKETS	256
+
+static const char *vector_names[N_VECTORS] = {
+	"RESET", "INT0", "INT1", "PCINT0", "PCINT1", "PCINT2", "WDT",
+	"TIMER2_COMPA", "TIMER2_COMPB", "TIMER2_OVF", "TIMER1_CAPT",
+	"TIMER1_COMPA", "TIMER1_COMPB", "TIMER1_OVF", "TIMER0_COMPA",
+	"TIMER0_COMPB", "TIMER0_OVF", "SPI_STC", "USART_RX", "USART_UDRE",
+	"USART_TX", "ADC", "EE_READY", "ANALOG_COMP", "TWI", "SPM_READY"
+};
+
+/******************************************************************************
+***************** S T R U C T U R E   D E C L A R A T I O N S *****************
+******************************************************************************/
+
+typedef struct {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+} stat_s;
+
+typedef struct {
+	stat_s run;				// cycles from vector entry to RETI
+	stat_s lat;				// cycles from flag raised to vector entry
+	uint64_t raised_at;		// 0: flag not pending
+	int served;				// flag still set but already dispatched
+} vector_s;
+
+typedef struct {
+	const char *name;
+	uint32_t addr;			// byte address
+	stat_s run;
+	uint64_t entry;			// 0: not active
+	uint16_t entry_sp;
+} func_s;
+
+typedef struct {
+	avr_irq_t *irq;			// TWI_IRQ_INPUT/TWI_IRQ_OUTPUT pair
+	uint8_t reg[64];
+	uint8_t ptr;
+	uint8_t selected;
+	uint8_t ptr_set;
+	uint8_t sqw;
+} ds1307_s;
+
+/******************************************************************************
+*************** G L O B A L   V A R S   D E F I N I T I O N S *****************
+******************************************************************************/
+
+static avr_t *avr;
+
+static vector_s vectors[N_VECTORS];
+static func_s funcs[MAX_FUNCS];
+static int n_funcs = 0;
+
+static int isr_stack[MAX_NEST];
+static uint64_t isr_entry[MAX_NEST];
+static int isr_depth = 0;
+static uint64_t isr_cycles = 0;		// outermost ISR time only
+
+static stat_s busy;					// main loop busy windows (PB4 high)
+static uint64_t busy_since = 0;
+static uint64_t busy_isr = 0;		// isr_cycles when the window opened
+static uint64_t busy_cycles = 0;
+
+static stat_s irq_off;				// I flag clear outside of ISRs
+static uint64_t irq_off_since = 0;
+static uint32_t irq_off_pc = 0;		// byte address where the current one began
+static uint32_t irq_off_max_pc = 0;	// ... and where the longest one began
+
+static ds1307_s rtc;
+
+/******************************************************************************
+******************* F U N C T I O N   D E F I N I T I O N S *******************
+******************************************************************************/
+
+/*===========================================================================*/
+static void stat_add(stat_s *s, uint64_t v)
+{
+	if ((s->count == 0) || (v < s->min)) s->min = v;
+	if (v > s->max) s->max = v;
+	s->total += v;
+	s->count++;
+}
+
+/*===========================================================================*/
+static void stat_print(FILE *f, const char *name, const stat_s *s)
+{
+	fprintf(f, "\"%s\": {\"count\": %llu, \"min\": %llu, \"avg\": %llu, \"max\": %llu}",
+		name, (unsigned long long)s->count, (unsigned long long)s->min,
+		(unsigned long long)(s->count ? s->total / s->count : 0),
+		(unsigned long long)s->max);
+}
+
+/*===========================================================================*/
+/*
+* Looks a symbol up with avr-nm (AVR_NM overrides the tool name).
+* Returns the address as printed by avr-nm, or -1.
+*/
+static long symbol_lookup(const char *elf, const char *name)
+{
+	char cmd[512];
+	char line[256];
+	char sym[128];
+	char type;
+	unsigned long addr;
+	long ret = -1;
+	const char *nm = getenv("AVR_NM") ? getenv("AVR_NM") : "avr-nm";
+	FILE *p;
+
+	snprintf(cmd, sizeof(cmd), "%s %s", nm, elf);
+	p = popen(cmd, "r");
+	if (p == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), p)) {
+		if (sscanf(line, "%lx %c %127s", &addr, &type, sym) != 3)
+			continue;
+		if (strcmp(sym, name) == 0) {
+			ret = (long)addr;
+			break;
+		}
+	}
+	pclose(p);
+
+	return ret;
+}
+
+/*===========================================================================*/
+static uint16_t read_sp(void)
+{
+	return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+/*===========================================================================*/
+/*
+* Main loop busy marker on PB4. The ISRs that run inside a window are
+* taken out of it: they are already in isr_cycles. PB4 only changes in the
+* main loop, so isr_cycles is up to date at both edges.
+*/
+static void busy_hook(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	uint64_t len;
+
+	(void)irq;
+	(void)param;
+
+	if (value) {
+		busy_since = avr->cycle;
+		busy_isr = isr_cycles;
+	} else if (busy_since) {
+		len = (avr->cycle - busy_since) - (isr_cycles - busy_isr);
+		stat_add(&busy, len);
+		busy_cycles += len;
+		busy_since = 0;
+	}
+}
+
+/*-----------------------------------------------------------------------------
+----------------------- D S 1 3 0 7   S T A N D - I N -------------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+static uint8_t bcd_inc(uint8_t v, uint8_t top, uint8_t first, int *carry)
+{
+	v = ((v & 0x0F) == 9) ? (v & 0xF0) + 0x10 : v + 1;
+	*carry = (v > top);
+	return *carry ? first : v;
+}
+
+/*===========================================================================*/
+/*
+* 2Hz timer: toggles SQW/OUT, the seconds count on the falling edge.
+*/
+static avr_cycle_count_t ds1307_sqw(struct avr_t *a, avr_cycle_count_t when, void *param)
+{
+	ds1307_s *p = param;
+	int carry;
+	uint8_t h;
+
+	p->sqw = !p->sqw;
+	if ((p->sqw == 0) && !(p->reg[0] & 0x80)) {
+		p->reg[0] = bcd_inc(p->reg[0], 0x59, 0x00, &carry);
+		if (carry) p->reg[1] = bcd_inc(p->reg[1], 0x59, 0x00, &carry);
+		if (carry) {
+			h = p->reg[2];
+			if (h & 0x40) {		// 12h mode
+				uint8_t v = bcd_inc(h & 0x1F, 0x12, 0x01, &carry);
+				if (v == 0x12) h ^= 0x20;
+				p->reg[2] = (h & 0x60) | v;
+			} else {
+				p->reg[2] = bcd_inc(h & 0x3F, 0x23, 0x00, &carry);
+			}
+		}
+	}
+	avr_raise_irq(avr_io_getirq(a, AVR_IOCTL_IOPORT_GETIRQ('D'), 2), p->sqw);
+
+	return when + (MCU_FREQ / 2);
+}
+
+/*===========================================================================*/
+static void ds1307_twi_hook(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	ds1307_s *p = param;
+	avr_twi_msg_irq_t v;
+
+	(void)irq;
+	v.u.v = value;
+
+	if (v.u.twi.msg & TWI_COND_STOP)
+		p->selected = 0;
+
+	if (v.u.twi.msg & TWI_COND_START) {
+		p->selected = 0;
+		p->ptr_set = 0;
+		if ((v.u.twi.addr & 0xFE) == DS1307_ADDR) {
+			p->selected = v.u.twi.addr;
+			avr_raise_irq(p->irq + TWI_IRQ_INPUT,
+				avr_twi_irq_msg(TWI_COND_ACK, p->selected, 1));
+		}
+	}
+
+	if (!p->selected)
+		return;
+
+	if (v.u.twi.msg & TWI_COND_WRITE) {
+		avr_raise_irq(p->irq + TWI_IRQ_INPUT,
+			avr_twi_irq_msg(TWI_COND_ACK, p->selected, 1));
+		if (!p->ptr_set) {
+			p->ptr = v.u.twi.data & 0x3F;
+			p->ptr_set = 1;
+		} else {
+			p->reg[p->ptr] = v.u.twi.data;
+			p->ptr = (p->ptr + 1) & 0x3F;
+		}
+	}
+
+	if (v.u.twi.msg & TWI_COND_READ) {
+		avr_raise_irq(p->irq + TWI_IRQ_INPUT,
+			avr_twi_irq_msg(TWI_COND_READ, p->selected, p->reg[p->ptr]));
+		p->ptr = (p->ptr + 1) & 0x3F;
+	}
+}
+
+/*===========================================================================*/
+static void ds1307_attach(ds1307_s *p)
+{
+	static const char *names[2] = { "8<ds1307.in", "32>ds1307.out" };
+	time_t now = time(NULL);
+	struct tm *t = localtime(&now);
+
+	memset(p, 0, sizeof(*p));
+	p->reg[0] = ((t->tm_sec / 10) << 4) | (t->tm_sec % 10);
+	p->reg[1] = ((t->tm_min / 10) << 4) | (t->tm_min % 10);
+	p->reg[2] = ((t->tm_hour / 10) << 4) | (t->tm_hour % 10);
+	p->reg[7] = 0x10;
+
+	p->irq = avr_alloc_irq(&avr->irq_pool, 0, 2, names);
+	avr_irq_register_notify(p->irq + TWI_IRQ_OUTPUT, ds1307_twi_hook, p);
+	avr_connect_irq(p->irq + TWI_IRQ_INPUT,
+		avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+	avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT),
+		p->irq + TWI_IRQ_OUTPUT);
+
+	avr_cycle_timer_register(avr, MCU_FREQ / 2, ds1307_sqw, p);
+}
+
+/*-----------------------------------------------------------------------------
+----------------------------- S I M U L A T I O N -----------------------------
+-----------------------------------------------------------------------------*/
+
+/*===========================================================================*/
+/*
+* Latches the cycle at which each enabled interrupt flag goes up.
+*/
+static void track_flags(void)
+{
+	for (int i = 0; i < avr->interrupts.vector_count; i++) {
+		avr_int_vector_t *v = avr->interrupts.vector[i];
+		vector_s *s;
+		int up;
+
+		if ((v == NULL) || (v->vector >= N_VECTORS))
+			continue;
+		s = &vectors[v->vector];
+		up = avr_regbit_get(avr, v->raised) && avr_regbit_get(avr, v->enable);
+		if (!up) {
+			s->raised_at = 0;
+			s->served = 0;
+		} else if ((s->raised_at == 0) && !s->served) {
+			s->raised_at = avr->cycle;
+		}
+	}
+}
+
+/*===========================================================================*/
+/*
+* Interrupts-disabled windows of the firmware's own making: I flag clear
+* while no ISR is running (CLI ... SEI, ATOMIC_BLOCK). The boot sequence,
+* before the first SEI, is left out.
+*/
+static void track_irq_off(avr_flashaddr_t pc)
+{
+	static int armed = 0;
+	int off = (avr->sreg[S_I] == 0) && (isr_depth == 0);
+
+	if (!armed) {
+		armed = !off;
+		return;
+	}
+
+	if (off && (irq_off_since == 0)) {
+		irq_off_since = avr->cycle;
+		irq_off_pc = pc;
+	} else if (!off && irq_off_since) {
+		uint64_t len = avr->cycle - irq_off_since;
+		if (len > irq_off.max)
+			irq_off_max_pc = irq_off_pc;
+		stat_add(&irq_off, len);
+		irq_off_since = 0;
+	}
+}
+
+/*===========================================================================*/
+static void step(void)
+{
+	avr_flashaddr_t pc = avr->pc;
+	uint16_t op = avr->flash[pc] | (avr->flash[pc + 1] << 8);
+	uint64_t now;
+
+	avr_run(avr);
+	now = avr->cycle;
+
+	// ISR exit
+	if ((op == OPCODE_RETI) && (isr_depth > 0)) {
+		isr_depth--;
+		stat_add(&vectors[isr_stack[isr_depth]].run, now - isr_entry[isr_depth]);
+		if (isr_depth == 0)
+			isr_cycles += now - isr_entry[0];
+	}
+
+	// ISR entry: execution lands on the vector table from outside of it
+	if ((avr->pc != 0) && (avr->pc < (N_VECTORS * 4)) && ((avr->pc & 3) == 0) &&
+		(pc >= (N_VECTORS * 4)) && (isr_depth < MAX_NEST)) {
+		int n = avr->pc / 4;
+		vector_s *s = &vectors[n];
+		if (s->raised_at) {
+			stat_add(&s->lat, now - s->raised_at);
+			s->raised_at = 0;
+			s->served = 1;
+		}
+		isr_stack[isr_depth] = n;
+		isr_entry[isr_depth] = now;
+		isr_depth++;
+	}
+
+	// function calls, timed until the stack unwinds past the entry frame
+	for (int i = 0; i < n_funcs; i++) {
+		func_s *f = &funcs[i];
+		if ((f->entry == 0) && (avr->pc == f->addr)) {
+			f->entry = now;
+			f->entry_sp = read_sp();
+		} else if ((f->entry) && (read_sp() > f->entry_sp + 1)) {
+			stat_add(&f->run, now - f->entry);
+			f->entry = 0;
+		}
+	}
+
+	track_flags();
+	track_irq_off(pc);
+}
+
+/*===========================================================================*/
+/*
+* Dumps the scheduler's task statistics straight from the simulated SRAM.
+* task_stats_s: uint16 runs, uint16 max, uint32 total, little endian.
+*/
+static void report_tasks(FILE *f, const char *elf)
+{
+	long stats = symbol_lookup(elf, "sched_stats");
+	long n = symbol_lookup(elf, "n_tasks");
+
+	if ((stats < 0) || (n < 0)) {
+		fprintf(f, "  \"tasks\": [],\n");
+		return;
+	}
+	stats -= SRAM_OFFSET;
+	n = avr->data[n - SRAM_OFFSET];
+
+	fprintf(f, "  \"tasks\": [\n");
+	for (long i = 0; i < n; i++) {
+		uint8_t *p = &avr->data[stats + (i * TASK_STATS_SIZE)];
+		uint32_t runs = p[0] | (p[1] << 8);
+		uint32_t max = p[2] | (p[3] << 8);
+		uint32_t total = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+
+		fprintf(f, "    {\"runs\": %u, \"avg_us\": %u, \"max_us\": %u}%s\n",
+			runs, runs ? (total / runs) * US_PER_T0_COUNT : 0,
+			max * US_PER_T0_COUNT, (i < n - 1) ? "," : "");
+	}
+	fprintf(f, "  ],\n");
+}
+
+/*===========================================================================*/
+/*
+* Dumps the PC-sampling histogram of a -DPROF build (src/prof.c), for
+* tools/prof. Left out when the firmware has no profiler.
+*/
+static void report_profile(FILE *f, const char *elf)
+{
+	long hist = symbol_lookup(elf, "prof_hist");
+	long over = symbol_lookup(elf, "prof_overflow");
+
+	if ((hist < 0) || (over < 0))
+		return;
+	hist -= SRAM_OFFSET;
+	over -= SRAM_OFFSET;
+
+	fprintf(f, "  \"profile\": {\"shift\": %d, \"overflow\": %u, \"counts\": [",
+		PROF_SHIFT, avr->data[over] | (avr->data[over + 1] << 8));
+	for (long i = 0; i < PROF_BUCKETS; i++) {
+		uint8_t *p = &avr->data[hist + (i * 2)];
+		fprintf(f, "%s%u", i ? ", " : "", p[0] | (p[1] << 8));
+	}
+	fprintf(f, "]},\n");
+}
+
+/*===========================================================================*/
+static void report(FILE *f, const char *elf, uint64_t cycles)
+{
+	uint64_t slots = cycles / CYCLES_PER_MS;	// 0 if run for under 1ms
+	uint64_t idle = cycles - isr_cycles - busy_cycles;
+	int first = 1;
+
+	if (cycles == 0)
+		cycles = 1;		// percentages of an empty run: all 0
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"firmware\": \"%s\",\n", elf);
+	fprintf(f, "  \"f_cpu\": %lu,\n", MCU_FREQ);
+	fprintf(f, "  \"cycles\": %llu,\n", (unsigned long long)cycles);
+	fprintf(f, "  \"vectors\": {\n");
+	for (int i = 1; i < N_VECTORS; i++) {
+		if (vectors[i].run.count == 0)
+			continue;
+		fprintf(f, "%s    \"%s\": {", first ? "" : ",\n", vector_names[i]);
+		stat_print(f, "cycles", &vectors[i].run);
+		fprintf(f, ", ");
+		stat_print(f, "latency", &vectors[i].lat);
+		fprintf(f, "}");
+		first = 0;
+	}
+	fprintf(f, "\n  },\n");
+	fprintf(f, "  \"functions\": {\n");
+	for (int i = 0; i < n_funcs; i++) {
+		fprintf(f, "    ");
+		stat_print(f, funcs[i].name, &funcs[i].run);
+		fprintf(f, "%s\n", (i < n_funcs - 1) ? "," : "");
+	}
+	fprintf(f, "  },\n");
+	report_tasks(f, elf);
+	report_profile(f, elf);
+	fprintf(f, "  \"main_loop\": {");
+	stat_print(f, "busy_cycles", &busy);
+	fprintf(f, ", \"busy_per_slot\": %llu},\n",
+		(unsigned long long)(slots ? busy_cycles / slots : 0));
+	fprintf(f, "  \"irq_off\": {");
+	stat_print(f, "cycles", &irq_off);
+	fprintf(f, ", \"max_us\": %.2f, \"max_at\": \"0x%04x\"},\n",
+		irq_off.max * 1e6 / MCU_FREQ, irq_off_max_pc);
+	fprintf(f, "  \"isr_pct\": %.2f,\n", 100.0 * isr_cycles / cycles);
+	fprintf(f, "  \"busy_pct\": %.2f,\n", 100.0 * busy_cycles / cycles);
+	fprintf(f, "  \"idle_pct\": %.2f\n", 100.0 * idle / cycles);
+	fprintf(f, "}\n");
+}
+
+/*===========================================================================*/
+int main(int argc, char *argv[])
+{
+	elf_firmware_t fw;
+	double seconds = 5.0;
+	uint64_t start, limit;
+	const char *elf;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:f:")) != -1) {
+		switch (opt) {
+			case 't':
+				seconds = atof(optarg);
+				break;
+			case 'f':
+				if (n_funcs < MAX_FUNCS)
+					funcs[n_funcs++].name = optarg;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-t seconds] [-f function]... main.elf\n", argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-t seconds] [-f function]... main.elf\n", argv[0]);
+		return 1;
+	}
+	elf = argv[optind];
+
+	memset(&fw, 0, sizeof(fw));
+	if (elf_read_firmware(elf, &fw)) {
+		fprintf(stderr, "bench: can't load %s\n", elf);
+		return 1;
+	}
+	fw.frequency = MCU_FREQ;
+
+	avr = avr_make_mcu_by_name(MCU_NAME);
+	if (avr == NULL) {
+		fprintf(stderr, "bench: unknown mcu %s\n", MCU_NAME);
+		return 1;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &fw);
+	avr->frequency = MCU_FREQ;
+	avr->vcc = avr->avcc = avr->aref = 5000;
+	avr->log = 0;
+
+	for (int i = 0; i < n_funcs; i++) {
+		long a = symbol_lookup(elf, funcs[i].name);
+		if (a < 0) {
+			fprintf(stderr, "bench: symbol %s not found\n", funcs[i].name);
+			return 1;
+		}
+		funcs[i].addr = (uint32_t)a;
+	}
+
+	// push buttons at rest: ladder input at Vcc
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC1), 5000);
+	avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), 4),
+		busy_hook, NULL);
+	ds1307_attach(&rtc);
+
+	start = avr->cycle;
+	limit = start + (uint64_t)(seconds * MCU_FREQ);
+	while (avr->cycle < limit) {
+		if ((avr->state == cpu_Done) || (avr->state == cpu_Crashed))
+			break;
+		step();
+	}
+
+	report(stdout, elf, avr->cycle - start);
+
+	return 0;
+}
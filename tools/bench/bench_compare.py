@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""
+Benchmarks two git revisions of the firmware on simavr and prints their
+results side by side.
+
+Each revision is checked out in a temporary worktree and built there with
+'make build DEFS=-DBENCH'. The ELF then runs under the bench runner of the
+current tree (output/bench, built by 'make bench'), so both sides are timed
+the same way. Revisions older than the PB4 busy marker simply have no main
+loop figures. Functions missing from one revision's ELF (e.g. set_digit
+before and tube_digit_pattern after a rewrite) are timed where they exist
+and shown as '-' elsewhere.
+
+Cycles are CPU cycles at F_CPU; avg is the mean per call or per interrupt.
+Vector latency runs from the interrupt flag being raised to the
+cycle of the vector entry, e.g. TIMER0_COMPA latency max is the worst
+delay of the mux step (d42af04^ against d42af04 shows what moving the RTC
+read out of TIMER1_COMPA_vect did to it).
+
+usage: bench_compare.py [-t seconds] [-f function]... [-D define]...
+                        [-r runner] rev_a rev_b
+"""
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+REPO = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+
+
+def symbols(elf):
+    """Names of the defined symbols of an ELF, from avr-nm."""
+    nm = os.environ.get("AVR_NM", "avr-nm")
+    out = subprocess.run([nm, "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    return {f[2] for f in (line.split() for line in out.splitlines())
+            if len(f) == 3}
+
+
+def bench_rev(rev, runner, seconds, funcs, defs):
+    """Builds 'rev' in a temporary worktree and returns its bench report."""
+    tmp = tempfile.mkdtemp(prefix="bench-")
+    tree = os.path.join(tmp, "tree")
+    try:
+        subprocess.run(["git", "-C", REPO, "worktree", "add", "--detach",
+                        tree, rev], check=True, capture_output=True)
+        subprocess.run(["make", "-C", tree, "build",
+                        "DEFS=" + " ".join(defs)], check=True,
+                       stdout=subprocess.DEVNULL)
+        elf = os.path.join(tree, "output", "main.elf")
+        have = symbols(elf)
+        cmd = [runner, "-t", str(seconds)]
+        for f in funcs:
+            if f in have:
+                cmd += ["-f", f]
+        out = subprocess.run(cmd + [elf], check=True, capture_output=True,
+                             text=True).stdout
+        return json.loads(out)
+    finally:
+        subprocess.run(["git", "-C", REPO, "worktree", "remove", "--force",
+                        tree], capture_output=True)
+        shutil.rmtree(tmp, ignore_errors=True)
+
+
+def rows(reports):
+    """Yields (label, value per report) for the figures worth comparing."""
+    vectors = sorted({v for r in reports for v in r["vectors"]})
+    for v in vectors:
+        for k in ("avg", "max"):
+            yield ("%s cycles %s" % (v, k),
+                   [r["vectors"].get(v, {}).get("cycles", {}).get(k)
+                    for r in reports])
+        for k in ("avg", "max"):
+            yield ("%s latency %s" % (v, k),
+                   [r["vectors"].get(v, {}).get("latency", {}).get(k)
+                    for r in reports])
+    funcs = sorted({f for r in reports for f in r["functions"]})
+    for f in funcs:
+        for k in ("avg", "max"):
+            yield ("%s() cycles %s" % (f, k),
+                   [r["functions"].get(f, {}).get(k) for r in reports])
+    yield ("irq off max us",
+           [r.get("irq_off", {}).get("max_us") for r in reports])
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("rev_a", help="baseline revision, e.g. 9261771^")
+    ap.add_argument("rev_b", help="revision to compare, e.g. 9261771")
+    ap.add_argument("-t", "--time", type=float, default=5,
+                    help="simulated seconds per run (default 5)")
+    ap.add_argument("-f", "--function", action="append", default=[],
+                    help="function to time per call, repeatable")
+    ap.add_argument("-D", "--define", action="append", default=["-DBENCH"],
+                    help="extra -D for both builds, repeatable")
+    ap.add_argument("-r", "--runner",
+                    default=os.path.join(REPO, "output", "bench"),
+                    help="bench runner (default output/bench)")
+    a = ap.parse_args()
+
+    if not os.access(a.runner, os.X_OK):
+        sys.exit("bench_compare: no runner at %s, run 'make bench' first"
+                 % a.runner)
+    defs = [d if d.startswith("-D") else "-D" + d for d in a.define]
+    reports = [bench_rev(r, a.runner, a.time, a.function, defs)
+               for r in (a.rev_a, a.rev_b)]
+
+    print("%-40s %12s %12s %8s" % ("", a.rev_a, a.rev_b, "delta"))
+    for label, (x, y) in rows(reports):
+        delta = "%+g" % (y - x) if x is not None and y is not None else ""
+        print("%-40s %12s %12s %8s" % (label, "-" if x is None else x,
+                                       "-" if y is None else y, delta))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""
+Maps the PC-sampling histogram of the profiler (src/prof.c, built with
+-DPROF) back to functions and prints a flat profile.
+
+Input is either the raw UART capture, e.g. 'cat /dev/ttyUSB0 > prof.bin'
+at 115200 8N1, or the JSON report of the simavr bench runner ('make prof').
+Each UART dump frame is:
+
+	'P' 'F' shift  buckets(LE16)  buckets * count(LE16)  overflow(LE16)  CRC-8
+
+Bucket i counts the samples taken between flash byte addresses
+i << shift and (i + 1) << shift. Frames with a bad CRC are skipped, the
+valid ones are summed. Function addresses come from 'avr-nm' on the ELF
+(AVR_NM overrides the tool name) or from the linker map file; a bucket
+shared by several functions is split by the bytes each one covers.
+
+usage: prof_map.py prof.bin|prof.json (-e main.elf | -m main.map) [--buckets]
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+HEAD_LEN = 5
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def frames(raw):
+    """Yields (shift, counts, overflow) for the valid frames in a capture."""
+    i = 0
+    while i + HEAD_LEN <= len(raw):
+        if raw[i] != ord('P') or raw[i + 1] != ord('F'):
+            i += 1
+            continue
+        shift = raw[i + 2]
+        n = raw[i + 3] | (raw[i + 4] << 8)
+        end = i + HEAD_LEN + (2 * n) + 2
+        if end >= len(raw):
+            break
+        if crc8(raw[i + 2:end]) != raw[end]:
+            i += 1
+            continue
+        body = raw[i + HEAD_LEN:end]
+        counts = [body[j] | (body[j + 1] << 8) for j in range(0, 2 * n, 2)]
+        yield shift, counts, body[-2] | (body[-1] << 8)
+        i = end + 1
+
+
+def load_histogram(path):
+    """Returns (shift, counts, overflow, frames) from a capture or a report."""
+    with open(path, "rb") as f:
+        raw = f.read()
+    if raw.lstrip().startswith(b"{"):
+        p = json.loads(raw)["profile"]
+        return p["shift"], p["counts"], p["overflow"], 1
+
+    shift, total, overflow, n = None, None, 0, 0
+    for s, counts, over in frames(raw):
+        if total is None:
+            shift, total = s, counts
+        elif s != shift or len(counts) != len(total):
+            sys.exit("prof_map: frames with different bucket layouts")
+        else:
+            total = [a + b for a, b in zip(total, counts)]
+        overflow += over
+        n += 1
+    if total is None:
+        sys.exit("prof_map: no valid frame in %s" % path)
+    return shift, total, overflow, n
+
+
+def symbols_nm(elf):
+    """Text symbols as (start, end, name), from avr-nm."""
+    nm = os.environ.get("AVR_NM", "avr-nm")
+    out = subprocess.run([nm, "-n", "-S", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    syms = []
+    for line in out.splitlines():
+        f = line.split()
+        if len(f) == 4 and f[2] in "tTwW":
+            start, size = int(f[0], 16), int(f[1], 16)
+            syms.append((start, start + size, f[3]))
+        elif len(f) == 3 and f[1] in "tTwW":
+            syms.append((int(f[0], 16), None, f[2]))
+    return close_ranges(syms)
+
+
+def symbols_map(path):
+    """Text symbols as (start, end, name), from the linker map file. The map
+    has no sizes, each symbol runs up to the next one."""
+    syms = []
+    in_text = False
+    with open(path) as f:
+        for line in f:
+            if line.startswith(".text"):
+                in_text = True
+            elif re.match(r"^\.\w", line):
+                in_text = False
+            m = re.match(r"^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_]\w*)\s*$", line)
+            if in_text and m:
+                syms.append((int(m.group(1), 16), None, m.group(2)))
+    return close_ranges(syms)
+
+
+def close_ranges(syms):
+    """Gives the symbols without a size the span up to the next symbol."""
+    syms.sort()
+    out = []
+    for i, (start, end, name) in enumerate(syms):
+        if end is None or end <= start:
+            end = syms[i + 1][0] if i + 1 < len(syms) else start + 2
+        out.append((start, end, name))
+    return out
+
+
+def attribute(shift, counts, syms):
+    """Splits each bucket's samples over the functions it overlaps."""
+    width = 1 << shift
+    per_func = {}
+    for i, c in enumerate(counts):
+        if c == 0:
+            continue
+        lo, hi = i * width, (i + 1) * width
+        overlaps = [(min(hi, e) - max(lo, s), n) for s, e, n in syms
+                    if s < hi and e > lo]
+        covered = sum(b for b, _ in overlaps)
+        if covered == 0:
+            per_func["?? 0x%04x" % lo] = per_func.get("?? 0x%04x" % lo, 0) + c
+            continue
+        for b, name in overlaps:
+            per_func[name] = per_func.get(name, 0) + c * b / covered
+    return per_func
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("input", help="UART capture or bench JSON report")
+    g = ap.add_mutually_exclusive_group(required=True)
+    g.add_argument("-e", "--elf", help="firmware ELF, read with avr-nm")
+    g.add_argument("-m", "--map", help="linker map file")
+    ap.add_argument("--buckets", action="store_true",
+                    help="also list the raw non-empty buckets")
+    a = ap.parse_args()
+
+    shift, counts, overflow, n = load_histogram(a.input)
+    syms = symbols_nm(a.elf) if a.elf else symbols_map(a.map)
+    total = sum(counts) + overflow
+    if total == 0:
+        sys.exit("prof_map: no samples")
+
+    print("%d samples, %d frame(s), %d byte buckets" % (total, n, 1 << shift))
+    print("%8s %7s  %s" % ("samples", "%", "function"))
+    per_func = attribute(shift, counts, syms)
+    if overflow:
+        per_func["(above 0x%04x)" % (len(counts) << shift)] = overflow
+    for name, c in sorted(per_func.items(), key=lambda x: -x[1]):
+        print("%8.1f %6.2f%%  %s" % (c, 100.0 * c / total, name))
+
+    if a.buckets:
+        print()
+        for i, c in enumerate(counts):
+            if c:
+                print("0x%04x %6d" % (i << shift, c))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+"""
+Sets the clock's time from the host clock over the console UART, using the
+binary frames of src/proto.c, to a few milliseconds.
+
+The DS1307 restarts its seconds countdown when the seconds register is
+written, so the second boundary lands where the write does. The tool
+measures the round trip with PROTO_PING frames, takes half of the fastest
+one as the one-way latency, and sends PROTO_SET_TIME that long before a
+whole second of the host clock, carrying that second. The firmware writes
+seconds, minutes and hours in a single burst. The result is read back
+with PROTO_GET_TIME.
+
+Works on a real port (115200 8N1) or on the host build's pseudo terminal
+('HOST_UART=pty ./output/nixie_host' prints its name).
+
+usage: nixie_timesync.py /dev/ttyUSB0 [--pings 8] [--utc] [--dry-run]
+"""
+
+import argparse
+import os
+import select
+import sys
+import termios
+import time
+
+# src/proto.h
+PROTO_SYNC = 0xA5
+PROTO_PING = 0x01
+PROTO_GET_TIME = 0x02
+PROTO_SET_TIME = 0x03
+PROTO_NAK = 0x7F
+PROTO_REPLY = 0x80
+STATUS = {0: "ok", -1: "bad command", -2: "out of range", -3: "busy",
+          -4: "frame corrupted on the way"}
+
+TIMEOUT_S = 0.5
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def frame(payload):
+    body = bytes([len(payload)]) + bytes(payload)
+    return bytes([PROTO_SYNC]) + body + bytes([crc8(body)])
+
+
+class Link:
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        t = termios.tcgetattr(self.fd)
+        t[0] = 0                                    # iflag
+        t[1] = 0                                    # oflag
+        t[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        t[3] = 0                                    # lflag: raw
+        t[4] = t[5] = termios.B115200
+        t[6][termios.VMIN] = 0
+        t[6][termios.VTIME] = 0
+        termios.tcsetattr(self.fd, termios.TCSANOW, t)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+        self.rx = bytearray()
+
+    def send(self, payload):
+        os.write(self.fd, frame(payload))
+
+    def reply(self, cmd):
+        """Waits for the reply to 'cmd'; returns (status, data). Console
+        text and frames for other commands are skipped; a NAK (the clock
+        got a corrupt frame) is returned as its status."""
+        end = time.monotonic() + TIMEOUT_S
+        while True:
+            while len(self.rx) >= 4:
+                if self.rx[0] != PROTO_SYNC:
+                    del self.rx[0]
+                    continue
+                n = self.rx[1]
+                if len(self.rx) < n + 3:
+                    break
+                body = bytes(self.rx[1:n + 2])
+                good = crc8(body) == self.rx[n + 2]
+                del self.rx[:(n + 3) if good else 1]
+                if good and n >= 2 and body[1] in (cmd | PROTO_REPLY,
+                                                   PROTO_NAK | PROTO_REPLY):
+                    status = body[2] - 256 if body[2] > 127 else body[2]
+                    return status, body[3:]
+            left = end - time.monotonic()
+            if left <= 0 or not select.select([self.fd], [], [], left)[0]:
+                sys.exit("timesync: no reply to command 0x%02x" % cmd)
+            self.rx += os.read(self.fd, 256)
+
+    def transact(self, payload):
+        self.send(payload)
+        return self.reply(payload[0])
+
+
+def round_trip(link, n):
+    """Fastest of 'n' ping round trips, in seconds: the one with the least
+    queueing on either side."""
+    best = None
+    for tag in range(n):
+        t0 = time.perf_counter()
+        status, data = link.transact([PROTO_PING, tag])
+        rtt = time.perf_counter() - t0
+        if status != 0 or data[:1] != bytes([tag]):
+            sys.exit("timesync: bad ping reply")
+        best = rtt if best is None else min(best, rtt)
+        time.sleep(0.01)
+    return best
+
+
+def host_time(t, utc):
+    tm = time.gmtime(t) if utc else time.localtime(t)
+    return tm.tm_hour, tm.tm_min, tm.tm_sec
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("port")
+    ap.add_argument("--pings", type=int, default=8)
+    ap.add_argument("--utc", action="store_true", help="set UTC, not local time")
+    ap.add_argument("--dry-run", action="store_true", help="only compare the clocks")
+    a = ap.parse_args()
+
+    link = Link(a.port)
+    rtt = round_trip(link, a.pings)
+    one_way = rtt / 2
+    print("round trip %.2f ms, one way %.2f ms" % (rtt * 1e3, one_way * 1e3))
+
+    if not a.dry_run:
+        # first whole second at least 50ms away, frame sent one_way before it
+        target = int(time.time() + one_way + 0.05) + 1
+        while True:
+            left = (target - one_way) - time.time()
+            if left <= 0:
+                break
+            time.sleep(left if left > 0.002 else 0)
+        link.send([PROTO_SET_TIME] + list(host_time(target, a.utc)))
+        status, _ = link.reply(PROTO_SET_TIME)
+        if status != 0:
+            sys.exit("timesync: set failed: %s" % STATUS.get(status, status))
+        print("set %02d:%02d:%02d" % host_time(target, a.utc))
+        time.sleep(1.2)       # firmware reads the RTC back on its next tick
+
+    status, data = link.transact([PROTO_GET_TIME])
+    now = time.time()
+    if status != 0:
+        sys.exit("timesync: get failed: %s" % STATUS.get(status, status))
+    h, m, s = host_time(now, a.utc)
+    diff = (data[0] * 3600 + data[1] * 60 + data[2]) - (h * 3600 + m * 60 + s)
+    if diff > 43200:
+        diff -= 86400
+    elif diff < -43200:
+        diff += 86400
+    print("clock %02d:%02d:%02d (%s), host %02d:%02d:%02d, %+d s" % (
+        data[0], data[1], data[2], "12h" if data[3] else "24h", h, m, s, diff))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""
+Decodes the trace dumps sent by the firmware (src/trace.c, built with
+-DTRACE) into the Chrome trace event JSON format, which Perfetto
+(https://ui.perfetto.dev) and chrome://tracing open directly.
+
+Input is the raw UART capture, e.g. from 'make trace' or from
+'cat /dev/ttyUSB0 > trace.bin' at 115200 8N1. Each dump frame is:
+
+	'T' 'R' count  count * (event, arg, tick LSB, tick MSB, T0 count)  CRC-8
+
+Timestamps are the 1ms Timer 0 tick plus the Timer 0 count (4us). Frames
+with a bad CRC are skipped.
+
+usage: trace2perfetto.py trace.bin [-o trace.json] [--tasks a,b,c]
+"""
+
+import argparse
+import json
+import sys
+
+US_PER_TICK = 1000
+US_PER_COUNT = 4
+TICK_WRAP = 1 << 16
+REC_LEN = 5
+
+# src/trace.h
+TRC_T0_BEGIN = 0x01
+TRC_T0_END = 0x02
+TRC_T1 = 0x03
+TRC_SQW = 0x04
+TRC_I2C_BEGIN = 0x05
+TRC_I2C_END = 0x06
+TRC_BTN = 0x07
+TRC_LOOP = 0x08
+TRC_TASK_BEGIN = 0x09
+TRC_TASK_END = 0x0A
+
+# src/main.c task table, in order
+DEFAULT_TASKS = "i2c_service,task_buttons,task_clock,task_display,task_anim,console_service"
+
+I2C_STATUS = {0x02: "done", 0x03: "error", 0x04: "timeout"}
+BTN_TYPES = {1: "press", 2: "short_release", 3: "hold", 4: "repeat",
+             5: "long_hold"}
+
+# Perfetto tracks (thread ids)
+TID_ISR = 1
+TID_MAIN = 2
+TID_I2C = 3
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def frames(raw):
+    """Yields the record lists of the valid frames in a capture."""
+    i = 0
+    while i + 3 <= len(raw):
+        if raw[i] != ord('T') or raw[i + 1] != ord('R'):
+            i += 1
+            continue
+        n = raw[i + 2]
+        end = i + 3 + n * REC_LEN
+        if end >= len(raw):
+            break
+        if crc8(raw[i + 2:end]) != raw[end]:
+            i += 1
+            continue
+        yield [raw[j:j + REC_LEN] for j in range(i + 3, end, REC_LEN)]
+        i = end + 1
+
+
+class Clock:
+    """Unwraps the 16 bit tick into a monotonic time in microseconds."""
+
+    def __init__(self):
+        self.base = 0
+        self.last = None
+
+    def us(self, tick, count):
+        if self.last is not None and tick < self.last - TICK_WRAP // 2:
+            self.base += TICK_WRAP
+        self.last = tick
+        return (self.base + tick) * US_PER_TICK + count * US_PER_COUNT
+
+
+def decode(raw, tasks):
+    events = [
+        {"ph": "M", "pid": 1, "name": "process_name", "args": {"name": "nixie_clock"}},
+        {"ph": "M", "pid": 1, "tid": TID_ISR, "name": "thread_name", "args": {"name": "ISR"}},
+        {"ph": "M", "pid": 1, "tid": TID_MAIN, "name": "thread_name", "args": {"name": "main loop"}},
+        {"ph": "M", "pid": 1, "tid": TID_I2C, "name": "thread_name", "args": {"name": "I2C bus"}},
+    ]
+    clock = Clock()
+
+    def ev(ph, tid, name, ts, args=None):
+        e = {"ph": ph, "pid": 1, "tid": tid, "name": name, "ts": ts}
+        if ph == "i":
+            e["s"] = "t"
+        if args:
+            e["args"] = args
+        events.append(e)
+
+    for records in frames(raw):
+        for r in records:
+            kind, arg = r[0], r[1]
+            ts = clock.us(r[2] | (r[3] << 8), r[4])
+            if kind == TRC_T0_BEGIN:
+                ev("B", TID_ISR, "mux", ts, {"latency_us": arg * US_PER_COUNT})
+            elif kind == TRC_T0_END:
+                ev("E", TID_ISR, "mux", ts)
+            elif kind == TRC_T1:
+                ev("i", TID_ISR, "timer1 tick", ts)
+            elif kind == TRC_SQW:
+                ev("i", TID_ISR, "sqw tick", ts)
+            elif kind == TRC_I2C_BEGIN:
+                ev("B", TID_I2C, "txn 0x%02x" % (arg & 0xFE), ts)
+            elif kind == TRC_I2C_END:
+                ev("E", TID_I2C, "", ts, {"status": I2C_STATUS.get(arg, arg)})
+            elif kind == TRC_BTN:
+                ev("i", TID_MAIN, "key %d %s" % (arg & 0x0F,
+                   BTN_TYPES.get(arg >> 4, arg >> 4)), ts)
+            elif kind == TRC_LOOP:
+                ev("i", TID_MAIN, "loop", ts, {"due": "0x%02x" % arg})
+            elif kind in (TRC_TASK_BEGIN, TRC_TASK_END):
+                name = tasks[arg] if arg < len(tasks) else "task %d" % arg
+                ev("B" if kind == TRC_TASK_BEGIN else "E", TID_MAIN, name, ts)
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("capture")
+    ap.add_argument("-o", "--output", default="-")
+    ap.add_argument("--tasks", default=DEFAULT_TASKS,
+                    help="scheduler task names, in table order")
+    a = ap.parse_args()
+
+    with open(a.capture, "rb") as f:
+        raw = f.read()
+    trace = decode(raw, a.tasks.split(","))
+
+    out = sys.stdout if a.output == "-" else open(a.output, "w")
+    json.dump(trace, out)
+    if out is not sys.stdout:
+        out.close()
+    n = sum(1 for e in trace["traceEvents"] if e["ph"] != "M")
+    print("%d events" % n, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()